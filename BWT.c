@@ -90,7 +90,7 @@ get_unique_elements(char * in, char ** out, uint n)
  * out: BWT
  * n: length of input string */
 int
-get_bwt(char** in, char*** out, uint64_t n, uint steps, uint64_t** end)
+get_bwt(char** in, char*** out, uint64_t n, uint steps, uint64_t** end, int64_t** sa)
 {
   saidx64_t * SA;
 
@@ -167,7 +167,10 @@ get_bwt(char** in, char*** out, uint64_t n, uint steps, uint64_t** end)
   for (int64_t i=0; i < steps; i++)
     (*out)[i][n+1] = 0;
 
-  free(SA);
+  if (sa != NULL)
+    *sa = (int64_t*) SA;
+  else
+    free(SA);
   return 0;
 }
 
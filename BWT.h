@@ -54,10 +54,12 @@ int get_unique_elements(char * in, char ** out, uint n);
   @param out Char array containing the BWT transform
   @param n Number of characters
   @param steps Number of steps proccessed in each iteration (see N-Steps FM-Index)
+  @param sa Suffix array (n+1 elements). If not NULL, it is returned instead
+  of being released
   @result Position of the final character of the string ($). Negative number if
   error.
 */
-int get_bwt(char** in, char*** out, uint64_t n, uint steps, uint64_t** end);
+int get_bwt(char** in, char*** out, uint64_t n, uint steps, uint64_t** end, int64_t** sa);
 
 /**
   @param bwt Char array containing the BWT. Will be modified inside.
@@ -40,6 +40,13 @@
 #include <string.h>
 #include <stdlib.h>
 #include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <immintrin.h>
 #ifdef KNL
 #include <hbwmalloc.h>
 #endif
@@ -81,32 +88,882 @@ file_to_char(const char * file, char ** data)
   return 0;
 }
 
-ssize_t
-read_seq_from_fasta(FILE * fp, char** line)
+int
+fasta_to_collection(char * data, uint64_t ** bounds, char *** names)
+{
+  uint64_t i = 0, len = 0;
+  int nseqs = 0, size = 64;
+
+  *bounds = malloc((size+1)*sizeof(uint64_t));
+  *names  = malloc(size*sizeof(char*));
+  if ((*bounds == NULL) || (*names == NULL))
+  {
+    fprintf(stderr, "Error at malloc for collection\n");
+    return -1;
+  }
+
+  while (data[i] != 0)
+  {
+    if (data[i] == '>')
+    {
+      // header: name up to the first blank
+      uint64_t name_len = 0;
+      i++;
+      while ((data[i+name_len] != 0) && (data[i+name_len] != '\n') && (data[i+name_len] != '\r')
+             && (data[i+name_len] != ' ') && (data[i+name_len] != '\t'))
+        name_len++;
+
+      if (nseqs >= size)
+      {
+        size *= 2;
+        *bounds = realloc(*bounds, (size+1)*sizeof(uint64_t));
+        *names  = realloc(*names, size*sizeof(char*));
+        if ((*bounds == NULL) || (*names == NULL))
+        {
+          fprintf(stderr, "Error at realloc for collection\n");
+          return -1;
+        }
+      }
+      (*names)[nseqs] = strndup(data + i, name_len);
+      (*bounds)[nseqs] = len;
+      nseqs++;
+
+      while ((data[i] != 0) && (data[i] != '\n')) i++;
+    }
+    else if ((data[i] == '\n') || (data[i] == '\r'))
+    {
+      i++;
+    }
+    else
+    {
+      if (nseqs == 0)
+      {
+        fprintf(stderr, "Error parsing FASTA collection: sequence without header\n");
+        return -1;
+      }
+      data[len++] = data[i++];  // len <= i: compaction in place
+    }
+  }
+  data[len] = 0;
+  (*bounds)[nseqs] = len;
+
+  return nseqs;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Sequence files: FASTA and FASTQ, plain, gzip or BGZF
+////////////////////////////////////////////////////////////////////////////////
+
+// minimum bytes of the sequence file parsed by a thread
+#define PARSE_PART (1UL << 20)
+
+// streamed input: bytes read ahead, and its formats
+#define INPUT_BUFFER (4UL << 20)
+#define INPUT_PLAIN 0
+#define INPUT_GZIP 1
+#define INPUT_BGZF 2
+
+// makes room in the arena for bytes more characters: the mapping grows
+// geometrically (2 MiB multiples) and may move, so the sequences are kept
+// as offsets until arena_lines()
+static void
+arena_reserve(read_arena_t *arena, uint64_t bytes)
+{
+  uint64_t size = arena->size? arena->size : (ALIGN_2MB);
+  char *text;
+
+  if (arena->bytes + bytes <= arena->size) return;
+  while (size < arena->bytes + bytes) size *= 2;
+  if (arena->text == NULL)
+    text = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  else
+    text = mremap(arena->text, arena->size, size, MREMAP_MAYMOVE);
+  if (text == MAP_FAILED)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  madvise(text, size, MADV_HUGEPAGE);
+  arena->text = text;
+  arena->size = size;
+}
+
+// symbols of the sequences: the index has no other ones, and the engines
+// would map N or any other letter to a base
+static const uint8_t dna_symbol[256] = { ['A'] = 1, ['C'] = 1, ['G'] = 1, ['T'] = 1,
+                                         ['a'] = 1, ['c'] = 1, ['g'] = 1, ['t'] = 1 };
+
+// copies len characters to the open sequence of the arena, returns non-zero
+// if any of them is not A, C, G or T
+static inline int
+arena_extend(read_arena_t *arena, const char *chars, uint64_t len)
+{
+  char *dst;
+  uint8_t bad = 0;
+
+  arena_reserve(arena, len + 1);
+  dst = arena->text + arena->bytes;
+  for (uint64_t i = 0; i < len; i++)
+  {
+    dst[i] = chars[i];
+    bad |= !dna_symbol[(uint8_t) chars[i]];
+  }
+  arena->bytes += len;
+  return bad;
+}
+
+// ends the open sequence, which starts at the byte start of the arena
+static inline void
+arena_close(read_arena_t *arena, uint64_t start)
+{
+  if (arena->count >= arena->slots)
+  {
+    arena->slots = arena->slots? 2*arena->slots : 4096;
+    arena->starts = realloc(arena->starts, (arena->slots+1)*sizeof(uint64_t));
+    arena->lens = realloc(arena->lens, (arena->slots+1)*sizeof(uint));
+    if ((arena->starts == NULL) || (arena->lens == NULL))
+    {
+      printf("Error at malloc\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  arena_reserve(arena, 1);
+  arena->text[arena->bytes] = 0;
+  arena->starts[arena->count] = start;
+  arena->lens[arena->count++] = arena->bytes - start;
+  arena->bytes++;
+}
+
+// pointers to the sequences of the arenas, in file order, and their lengths
+static uint
+arena_lines(read_arena_t *parts, uint nparts, char ***lines_out, uint **lines_len_out)
+{
+  uint count = 0, i = 0;
+
+  for (uint p = 0; p < nparts; p++) count += parts[p].count;
+  *lines_out = malloc((count+1)*sizeof(char*));
+  *lines_len_out = malloc((count+1)*sizeof(uint));
+  if ((*lines_out == NULL) || (*lines_len_out == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  for (uint p = 0; p < nparts; p++)
+  {
+    for (uint j = 0; j < parts[p].count; j++, i++)
+      (*lines_out)[i] = parts[p].text + parts[p].starts[j];
+    memcpy(*lines_len_out + i - parts[p].count, parts[p].lens, parts[p].count*sizeof(uint));
+  }
+  return count;
+}
+
+void
+arena_free(read_arena_t *arena)
+{
+  if (arena->text != NULL) munmap(arena->text, arena->size);
+  free(arena->starts);
+  free(arena->lens);
+  *arena = (read_arena_t) { 0 };
+}
+
+// first '\n' in [p, end) (end if none), 32 or 16 bytes compared at a time
+static inline const char *
+find_newline(const char *p, const char *end)
+{
+#ifdef __AVX2__
+  const __m256i newline32 = _mm256_set1_epi8('\n');
+  for (; p + 32 <= end; p += 32)
+  {
+    uint32_t m = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*) p), newline32));
+    if (m) return p + __builtin_ctz(m);
+  }
+#endif
+  const __m128i newline = _mm_set1_epi8('\n');
+  for (; p + 16 <= end; p += 16)
+  {
+    uint m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) p), newline));
+    if (m) return p + __builtin_ctz(m);
+  }
+  while ((p < end) && (*p != '\n')) p++;
+  return p;
+}
+
+// length of the line starting at p (without "\r\n"), *next: following line
+static uint64_t
+line_length(const char *p, const char *end, const char **next)
+{
+  const char *eol = find_newline(p, end);
+  *next = (eol < end)? eol + 1 : end;
+  while ((eol > p) && (eol[-1] == '\r')) eol--;
+  return eol - p;
+}
+
+// tells whether a FASTQ record starts at the '@' line p: sequence lines of
+// letters up to a '+' line, then quality lines with as many values as bases,
+// then the end of the data or another '@' line. A quality line may start with
+// '@', but the lines that follow it do not make such a record (a header is
+// not a sequence line), whether the records are wrapped or not
+static int
+fastq_record_at(const char *p, const char *end)
+{
+  const char *next;
+  uint64_t bases = 0, quality = 0, len;
+
+  line_length(p, end, &next);
+  while ((next < end) && (*next != '+'))
+  {
+    const char *line = next;
+    len = line_length(line, end, &next);
+    for (uint64_t i = 0; i < len; i++)
+      if ((uint8_t)((line[i] | 0x20) - 'a') >= 26) return 0;
+    bases += len;
+  }
+  if (next >= end) return 0;
+  line_length(next, end, &next);
+  uint lines = 0;
+  for (; (next < end) && ((quality < bases) || (lines == 0)); lines++)
+    quality += line_length(next, end, &next);
+  return (lines > 0) && (quality == bases) && ((next >= end) || (*next == '@'));
+}
+
+// first record starting at or after the byte pos: a '>' at the beginning of a
+// line (FASTA), or a '@' line that starts a whole record (FASTQ, see
+// fastq_record_at())
+static uint64_t
+record_start(const char *data, uint64_t size, uint64_t pos, int fastq)
+{
+  const char *end = data + size, *p = data + pos, *next;
+
+  if (pos == 0) return 0;
+  if (p[-1] != '\n')
+  {
+    line_length(p, end, &next);
+    p = next;
+  }
+  for (; p < end; p = next)
+  {
+    line_length(p, end, &next);
+    if (!fastq && (*p == '>')) break;
+    if (fastq && (*p == '@') && fastq_record_at(p, end)) break;
+  }
+  return p - data;
+}
+
+const char *
+parse_record(const char *p, const char *stop, int more, int fastq,
+             const char *name, uint64_t at, read_arena_t *arena)
+{
+  const char *next;
+  uint64_t start = arena->bytes, len, quality = 0;
+  int bad = 0, complete;
+
+  // header, then sequence lines up to the next record (FASTA) or '+' (FASTQ)
+  line_length(p, stop, &next);
+  while ((next < stop) && (*next != (fastq? '+' : '>')))
+  {
+    const char *line = next;
+    len = line_length(line, stop, &next);
+    bad |= arena_extend(arena, line, len);
+  }
+  if (bad)
+  {
+    printf("ERROR: symbol other than A, C, G or T in the record at byte %lu of %s\n\n", at, name);
+    exit(1);
+  }
+  complete = !more || (next < stop);
+  if (fastq && complete)
+  {
+    if (next >= stop)
+    {
+      printf("ERROR: FASTQ record at byte %lu of %s has no quality line\n\n", at, name);
+      exit(1);
+    }
+    // '+' line, then as many quality values as bases (one line at least)
+    line_length(next, stop, &next);
+    uint lines = 0;
+    for (; (next < stop) && ((quality < arena->bytes - start) || (lines == 0)); lines++)
+      quality += line_length(next, stop, &next);
+    complete = !more || ((quality >= arena->bytes - start) && (lines > 0));
+  }
+  if (!complete)
+  {
+    arena->bytes = start;
+    return NULL;
+  }
+  arena_close(arena, start);
+  return next;
+}
+
+// parses the records of a FASTA (sequences wrapped in any number of lines) or
+// FASTQ file whose header starts in the bytes [begin, end) of data, and
+// appends their sequences to the arena; returns the number of bases
+static uint64_t
+parse_records(const char *data, uint64_t size, uint64_t begin, uint64_t end,
+              int fastq, const char *name, read_arena_t *arena)
+{
+  const char *stop = data + size, *p;
+  uint64_t bases = arena->bytes - arena->count;
+
+  for (p = data + record_start(data, size, begin, fastq); (p < stop) && (p < data + end);
+       p = parse_record(p, stop, 0, fastq, name, p - data, arena));
+  return arena->bytes - arena->count - bases;
+}
+
+#if ZLIB
+// size of the BGZF block at p (a gzip member whose extra field stores its
+// size in a BC subfield), 0 if it is not one or it is cut at left bytes
+static uint64_t
+bgzf_block_size(const uint8_t *p, uint64_t left)
+{
+  uint xlen;
+
+  if ((left < 18) || (p[0] != 31) || (p[1] != 139) || (p[2] != 8) || !(p[3] & 4)) return 0;
+  xlen = p[10] | (p[11] << 8);
+  for (uint i = 12; (i + 6 <= 12 + xlen) && (i + 6 <= left); i += 4 + (p[i+2] | (p[i+3] << 8)))
+  {
+    if ((p[i] == 'B') && (p[i+1] == 'C') && ((p[i+2] | (p[i+3] << 8)) == 2))
+    {
+      uint64_t size = (p[i+4] | (p[i+5] << 8)) + 1;
+      return ((size >= 12 + xlen + 8) && (size <= left))? size : 0;
+    }
+  }
+  return 0;
+}
+
+// BGZF blocks [first, last) inflated by a thread into text + out[b]
+typedef struct bgzf_part {
+  const uint8_t *data;
+  const uint64_t *blocks, *out;   // offset of each block in data and in text
+  uint first, last;
+  char *text;
+  int64_t failed;                 // first corrupt block, -1 if none
+} bgzf_part_t;
+
+static void *
+bgzf_worker(void *arg)
+{
+  bgzf_part_t *part = arg;
+  z_stream z = { 0 };
+
+  part->failed = -1;
+  if (inflateInit2(&z, -15) != Z_OK)
+  {
+    part->failed = part->first;
+    return NULL;
+  }
+  for (uint b = part->first; b < part->last; b++)
+  {
+    const uint8_t *block = part->data + part->blocks[b];
+    uint64_t header = 12 + (block[10] | (block[11] << 8));
+    uint64_t size = part->blocks[b+1] - part->blocks[b], len = part->out[b+1] - part->out[b];
+    const uint8_t *tail = block + size - 8;
+
+    if (len == 0) continue;
+    inflateReset(&z);
+    z.next_in = (Bytef*) block + header;
+    z.avail_in = size - header - 8;
+    z.next_out = (Bytef*) part->text + part->out[b];
+    z.avail_out = len;
+    if ((inflate(&z, Z_FINISH) != Z_STREAM_END) || (z.avail_out != 0) ||
+        (crc32(0, (Bytef*) part->text + part->out[b], len) !=
+         (uLong)(tail[0] | (tail[1] << 8) | (tail[2] << 16) | ((uint32_t) tail[3] << 24))))
+    {
+      part->failed = b;
+      break;
+    }
+  }
+  inflateEnd(&z);
+  return NULL;
+}
+
+// place of the BGZF blocks [0, nblocks) of data in their text, from their
+// sizes (ISIZE): out[b] is the offset of block b and out[nblocks] the size
+// of the text
+static uint64_t
+bgzf_text_size(const uint8_t *data, const uint64_t *blocks, uint nblocks, uint64_t *out)
+{
+  out[0] = 0;
+  for (uint b = 0; b < nblocks; b++)
+  {
+    const uint8_t *isize = data + blocks[b+1] - 4;
+    out[b+1] = out[b] + (isize[0] | (isize[1] << 8) | (isize[2] << 16) | ((uint32_t) isize[3] << 24));
+  }
+  return out[nblocks];
+}
+
+// inflates the BGZF blocks [0, nblocks) of data into text + out[b], a range
+// of blocks per thread; at is the offset of data in the file name (errors)
+static void
+bgzf_inflate(const uint8_t *data, const uint64_t *blocks, const uint64_t *out, uint nblocks,
+             char *text, const char *name, uint64_t at, uint nthreads)
+{
+  uint nparts = (nblocks < nthreads)? nblocks : nthreads;
+  bgzf_part_t *parts;
+  pthread_t *threads;
+
+  parts = malloc(nparts*sizeof(bgzf_part_t));
+  threads = malloc(nparts*sizeof(pthread_t));
+  if ((parts == NULL) || (threads == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  for (uint p = 0; p < nparts; p++)
+  {
+    parts[p] = (bgzf_part_t) { data, blocks, out, (uint)((uint64_t) nblocks*p/nparts),
+                               (uint)((uint64_t) nblocks*(p+1)/nparts), text, -1 };
+    if ((p > 0) && (pthread_create(&threads[p], NULL, bgzf_worker, &parts[p]) != 0))
+    {
+      printf("Error creating inflate thread %u\n", p);
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (nparts > 0) bgzf_worker(&parts[0]);
+  for (uint p = 0; p < nparts; p++)
+  {
+    if (p > 0) pthread_join(threads[p], NULL);
+    if (parts[p].failed >= 0)
+    {
+      printf("ERROR: corrupt BGZF block at byte %lu of %s\n\n", at + blocks[parts[p].failed], name);
+      exit(1);
+    }
+  }
+  free(parts);
+  free(threads);
+}
+
+// inflates a BGZF file: the blocks are located from their headers and their
+// sizes (ISIZE) give the place of each one in the text, so that they are
+// inflated in parallel, a range of blocks per thread; returns 0 if the file
+// is not made of BGZF blocks
+static int
+inflate_bgzf(const uint8_t *data, uint64_t size, const char *name, read_arena_t *text, uint nthreads)
+{
+  uint64_t *blocks, *out, pos = 0, block;
+  uint nblocks = 0, slots = 4096;
+
+  blocks = malloc((slots+1)*sizeof(uint64_t));
+  if (blocks == NULL)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  while (pos < size)
+  {
+    if ((block = bgzf_block_size(data + pos, size - pos)) == 0)
+    {
+      free(blocks);
+      return 0;
+    }
+    if (nblocks >= slots)
+    {
+      slots *= 2;
+      blocks = realloc(blocks, (slots+1)*sizeof(uint64_t));
+      if (blocks == NULL)
+      {
+        printf("Error at malloc\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    blocks[nblocks++] = pos;
+    pos += block;
+  }
+  blocks[nblocks] = size;
+
+  out = malloc((nblocks+1)*sizeof(uint64_t));
+  if (out == NULL)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  text->bytes = bgzf_text_size(data, blocks, nblocks, out);
+  arena_reserve(text, text->bytes + 1);
+  bgzf_inflate(data, blocks, out, nblocks, text->text, name, 0, nthreads);
+  free(blocks);
+  free(out);
+  return 1;
+}
+
+// inflates a gzip file (one or several members) into the text arena; BGZF
+// files are inflated in parallel
+static void
+inflate_input(const uint8_t *data, uint64_t size, const char *name, read_arena_t *text, uint nthreads)
+{
+  z_stream z = { 0 };
+  uint64_t pos = 0;
+  int ret;
+
+  if (inflate_bgzf(data, size, name, text, nthreads)) return;
+
+  if (inflateInit2(&z, 15 + 16) != Z_OK)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  for (;;)
+  {
+    if ((z.avail_in == 0) && (pos < size))
+    {
+      z.next_in = (Bytef*) data + pos;
+      z.avail_in = (size - pos < (1UL << 30))? size - pos : (1UL << 30);
+      pos += z.avail_in;
+    }
+    arena_reserve(text, 1UL << 20);
+    z.next_out = (Bytef*) text->text + text->bytes;
+    z.avail_out = (text->size - text->bytes < (1UL << 30))? text->size - text->bytes : (1UL << 30);
+    uint avail = z.avail_out;
+    ret = inflate(&z, Z_NO_FLUSH);
+    text->bytes += avail - z.avail_out;
+    if (ret == Z_STREAM_END)
+    {
+      // concatenated members
+      if ((z.avail_in == 0) && (pos < size))
+      {
+        z.next_in = (Bytef*) data + pos;
+        z.avail_in = (size - pos < (1UL << 30))? size - pos : (1UL << 30);
+        pos += z.avail_in;
+      }
+      if ((z.avail_in < 2) || (z.next_in[0] != 31) || (z.next_in[1] != 139)) break;
+      inflateReset(&z);
+    }
+    else if ((ret != Z_OK) && ((ret != Z_BUF_ERROR) || ((z.avail_in == 0) && (pos >= size))))
+    {
+      printf("ERROR: %s is not a valid gzip file (%s)\n\n", name, z.msg? z.msg : "truncated");
+      exit(1);
+    }
+  }
+  inflateEnd(&z);
+}
+#endif
+
+// part of the sequence file parsed by a thread
+typedef struct parse_part {
+  const char *data, *name;
+  uint64_t size, begin, end, bases;
+  int fastq;
+  read_arena_t *arena;
+} parse_part_t;
+
+static void *
+parse_worker(void *arg)
+{
+  parse_part_t *part = arg;
+  part->bases = parse_records(part->data, part->size, part->begin, part->end,
+                              part->fastq, part->name, part->arena);
+  return NULL;
+}
+
+// the file is mapped and parsed in place, split in a part per thread (at
+// least PARSE_PART bytes each) that is resynchronized on the first record
+// starting in it. gzip and BGZF files are inflated first, and [begin, end)
+// scaled to the text. *bytes: size of the range. The parsers are POSIX threads:
+// shard workers are forked after loading, and a child does not inherit the
+// threads of an OpenMP team of its parent
+uint
+load_sequences(const char *seq_file, long begin, long end, uint nthreads,
+               read_arena_t **arenas_out, uint *narenas_out,
+               char ***lines_out, uint **lines_len_out, uint64_t *bases, uint64_t *bytes)
+{
+  struct stat st;
+  char *data = NULL;
+  uint64_t size;
+  uint narenas;
+  read_arena_t input = { 0 }, *arenas;
+  parse_part_t *parts;
+  pthread_t *threads;
+  int fd;
+
+  fd = open(seq_file, O_RDONLY);
+  if ((fd < 0) || (fstat(fd, &st) < 0))
+  {
+    printf("Error opening file %s\n", seq_file);
+    exit(EXIT_FAILURE);
+  }
+  if (st.st_size > 0)
+  {
+    data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED)
+    {
+      printf("Error opening file %s\n", seq_file);
+      exit(EXIT_FAILURE);
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+  }
+  close(fd);
+
+  size = st.st_size;
+  if ((end < 0) || (end > st.st_size)) end = st.st_size;
+  if (begin > end) begin = end;
+  if ((size >= 2) && ((uint8_t) data[0] == 31) && ((uint8_t) data[1] == 139))
+  {
+#if ZLIB
+    inflate_input((uint8_t*) data, size, seq_file, &input, nthreads);
+    munmap(data, st.st_size);
+    data = input.text;
+    begin = (unsigned __int128) begin*input.bytes/size;
+    end = (unsigned __int128) end*input.bytes/size;
+    size = input.bytes;
+#else
+    printf("ERROR: %s is compressed, build with zlib support (make z=1)\n\n", seq_file);
+    exit(1);
+#endif
+  }
+  *bytes = end - begin;
+  if ((size > 0) && (data[0] != '>') && (data[0] != '@'))
+  {
+    printf("ERROR: %s is not a FASTA or FASTQ file\n\n", seq_file);
+    exit(1);
+  }
+
+  narenas = (*bytes/PARSE_PART < nthreads)? *bytes/PARSE_PART + 1 : nthreads;
+  arenas = calloc(narenas, sizeof(read_arena_t));
+  parts = malloc(narenas*sizeof(parse_part_t));
+  threads = malloc(narenas*sizeof(pthread_t));
+  if ((arenas == NULL) || (parts == NULL) || (threads == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (uint p = 0; p < narenas; p++)
+  {
+    parts[p] = (parse_part_t) { data, seq_file, size, begin + *bytes*p/narenas,
+                                begin + *bytes*(p+1)/narenas, 0,
+                                (data != NULL) && (data[0] == '@'), &arenas[p] };
+    if ((p > 0) && (pthread_create(&threads[p], NULL, parse_worker, &parts[p]) != 0))
+    {
+      printf("Error creating parser thread %u\n", p);
+      exit(EXIT_FAILURE);
+    }
+  }
+  parse_worker(&parts[0]);
+  *bases = parts[0].bases;
+  for (uint p = 1; p < narenas; p++)
+  {
+    pthread_join(threads[p], NULL);
+    *bases += parts[p].bases;
+  }
+  free(parts);
+  free(threads);
+  if (input.text != NULL) arena_free(&input);
+  else if (data != NULL) munmap(data, st.st_size);
+
+  *arenas_out = arenas;
+  *narenas_out = narenas;
+  return arena_lines(arenas, narenas, lines_out, lines_len_out);
+}
+
+// moves the unused input of the stream to the start of its buffer and reads
+// as much as fits after it (less only at the end of the input)
+static void
+seq_stream_fill(seq_stream_t *s)
+{
+  long got;
+
+  memmove(s->input, s->input + s->input_pos, s->input_len - s->input_pos);
+  s->input_at += s->input_pos;
+  s->input_len -= s->input_pos;
+  s->input_pos = 0;
+  while (!s->input_end && (s->input_len < INPUT_BUFFER))
+  {
+    got = read(s->fd, s->input + s->input_len, INPUT_BUFFER - s->input_len);
+    if ((got < 0) && (errno == EINTR)) continue;
+    if (got < 0)
+    {
+      printf("ERROR: reading %s\n\n", s->name);
+      exit(1);
+    }
+    s->input_len += got;
+    s->input_end = (got == 0);
+  }
+}
+
+// replaces the text of the stream by the next piece of its input, inflated
+// if it is compressed; returns 0 at the end of the input
+static int
+seq_stream_decode(seq_stream_t *s)
 {
-  size_t len = 0;
-  ssize_t read = 0;
+  s->text_pos = s->text_len = 0;
+  if (s->format == INPUT_PLAIN)
+  {
+    s->input_pos = s->input_len;
+    seq_stream_fill(s);
+    s->text = (char*) s->input;
+    s->text_len = s->input_pos = s->input_len;
+    return (s->text_len > 0);
+  }
+#if ZLIB
+  if (s->format == INPUT_BGZF)
+  {
+    // the whole blocks read ahead are inflated in parallel (the last one
+    // may be cut, it waits for the next piece)
+    uint64_t pos = 0, block;
+    uint nblocks = 0;
 
-  // read header
-  read = getline(line, &len, fp);
-  if (read == -1) return -1;
-  if ((*line)[0] != '>') return -1;
+    seq_stream_fill(s);
+    while ((block = bgzf_block_size(s->input + pos, s->input_len - pos)) > 0)
+    {
+      s->blocks[nblocks++] = pos;
+      pos += block;
+    }
+    if (nblocks == 0)
+    {
+      if (s->input_len == 0) return 0;
+      printf("ERROR: %s is not a valid BGZF file (byte %lu)\n\n", s->name, s->input_at);
+      exit(1);
+    }
+    s->blocks[nblocks] = pos;
+    s->text_len = bgzf_text_size(s->input, s->blocks, nblocks, s->block_out);
+    if (s->text_len > s->text_size)
+    {
+      s->text_size = s->text_len;
+      s->text = realloc(s->text, s->text_size);
+      if (s->text == NULL)
+      {
+        printf("Error at malloc\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    bgzf_inflate(s->input, s->blocks, s->block_out, nblocks, s->text, s->name, s->input_at, s->nthreads);
+    s->input_pos = pos;
+    return 1;
+  }
 
-  if ((read = getline(line, &len, fp)) == -1)
+  // gzip: one or several members inflated serially
+  s->z.next_out = (Bytef*) s->text;
+  s->z.avail_out = s->text_size;
+  while ((s->z.avail_out > 0) && !s->z_end)
   {
-     fprintf(stderr, "Error parsing FASTA sequence header\n");
-     return -1;
+    int ret;
+
+    if (s->z.avail_in == 0)
+    {
+      s->input_pos = s->input_len;
+      seq_stream_fill(s);
+      s->z.next_in = s->input;
+      s->z.avail_in = s->input_len;
+      if (s->input_len == 0)
+      {
+        printf("ERROR: %s is not a valid gzip file (truncated)\n\n", s->name);
+        exit(1);
+      }
+    }
+    ret = inflate(&s->z, Z_NO_FLUSH);
+    if (ret == Z_STREAM_END)
+    {
+      // concatenated members
+      s->input_pos = s->z.next_in - s->input;
+      if (s->input_len - s->input_pos < 2) seq_stream_fill(s);
+      s->z.next_in = s->input + s->input_pos;
+      s->z.avail_in = s->input_len - s->input_pos;
+      if ((s->z.avail_in < 2) || (s->z.next_in[0] != 31) || (s->z.next_in[1] != 139))
+        s->z_end = 1;
+      else
+        inflateReset(&s->z);
+    }
+    else if ((ret != Z_OK) && (ret != Z_BUF_ERROR))
+    {
+      printf("ERROR: %s is not a valid gzip file (%s)\n\n", s->name, s->z.msg? s->z.msg : "corrupt");
+      exit(1);
+    }
   }
+  s->text_len = s->text_size - s->z.avail_out;
+  return (s->text_len > 0);
+#else
+  return 0;
+#endif
+}
 
-  if ( ((*line)[read-1] != '\n') && ((*line)[read-1] != '\r') )
+void
+seq_stream_open(seq_stream_t *s, const char *seq_file, uint nthreads)
+{
+  *s = (seq_stream_t) { 0 };
+  s->name = seq_file;
+  s->nthreads = nthreads;
+  s->fd = (strcmp(seq_file, "-") == 0)? STDIN_FILENO : open(seq_file, O_RDONLY);
+  s->input = malloc(INPUT_BUFFER);
+  if (s->fd < 0)
   {
-    (*line)[read] = 0;    // if (len == read) ????
+    printf("Error opening file %s\n", seq_file);
+    exit(EXIT_FAILURE);
   }
-  else while ( ((*line)[read-1] == '\n') || ((*line)[read-1] == '\r') )
+  if (s->input == NULL)
   {
-    (*line)[read-1] = 0;
-    read--;
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
   }
+  seq_stream_fill(s);
 
-  return read;
+  s->format = INPUT_PLAIN;
+  if ((s->input_len >= 2) && (s->input[0] == 31) && (s->input[1] == 139))
+  {
+#if ZLIB
+    s->text_size = INPUT_BUFFER;
+    if (bgzf_block_size(s->input, s->input_len) > 0)
+    {
+      // a block takes at least 26 bytes (header, BC subfield and trailer)
+      s->format = INPUT_BGZF;
+      s->blocks = malloc((INPUT_BUFFER/26 + 1)*sizeof(uint64_t));
+      s->block_out = malloc((INPUT_BUFFER/26 + 1)*sizeof(uint64_t));
+    }
+    else
+    {
+      s->format = INPUT_GZIP;
+      if (inflateInit2(&s->z, 15 + 16) != Z_OK) s->text_size = 0;
+      s->z.next_in = s->input;
+      s->z.avail_in = s->input_len;
+      s->input_pos = s->input_len;
+      s->blocks = s->block_out = malloc(1);
+    }
+    s->text = malloc(s->text_size);
+    if ((s->text_size == 0) || (s->text == NULL) || (s->blocks == NULL) || (s->block_out == NULL))
+    {
+      printf("Error at malloc\n");
+      exit(EXIT_FAILURE);
+    }
+#else
+    printf("ERROR: %s is compressed, build with zlib support (make z=1)\n\n", seq_file);
+    exit(1);
+#endif
+  }
+  else
+  {
+    // the text is the input itself
+    s->text = (char*) s->input;
+    s->text_len = s->input_pos = s->input_len;
+  }
+}
+
+void
+seq_stream_close(seq_stream_t *s)
+{
+#if ZLIB
+  if (s->format != INPUT_PLAIN)
+  {
+    if (s->format == INPUT_GZIP) inflateEnd(&s->z);
+    if (s->blocks != s->block_out) free(s->block_out);
+    free(s->blocks);
+    free(s->text);
+  }
+#endif
+  free(s->input);
+  if (s->fd != STDIN_FILENO) close(s->fd);
+}
+
+uint64_t
+seq_stream_read(seq_stream_t *s, char *buf, uint64_t n)
+{
+  uint64_t got = 0;
+
+  while (got < n)
+  {
+    uint64_t m;
+
+    if ((s->text_pos == s->text_len) && !seq_stream_decode(s)) break;
+    m = (n - got < s->text_len - s->text_pos)? n - got : s->text_len - s->text_pos;
+    memcpy(buf + got, s->text + s->text_pos, m);
+    s->text_pos += m;
+    got += m;
+  }
+  return got;
 }
@@ -41,6 +41,40 @@
 #include <stdio.h>
 #include "types.h"
 
+#if ZLIB
+#include <zlib.h>
+#endif
+
+// text of the loaded sequences (load_sequences()): NUL-terminated one after
+// another in a single anonymous mapping that doubles when full (transparent
+// huge pages), instead of a heap buffer per sequence; lines[i] points into it.
+// The file is parsed in parts, one arena per part, filled by the thread that
+// parses it (memory local to that thread)
+typedef struct read_arena {
+  char *text;
+  uint64_t bytes, size;   // used and mapped bytes
+  uint64_t *starts;       // first byte of each sequence
+  uint *lens;
+  uint count, slots;
+} read_arena_t;
+
+// sequence file read as a stream (plain, gzip or BGZF), see seq_stream_open()
+typedef struct seq_stream {
+  const char *name;
+  int fd, format;               // INPUT_PLAIN, INPUT_GZIP or INPUT_BGZF
+  uint nthreads;                // threads inflating BGZF blocks
+  uint8_t *input;               // input read ahead, [input_pos, input_len) unused
+  uint64_t input_pos, input_len, input_at;  // input_at: offset of input in the file
+  int input_end;
+  char *text;                   // inflated input, [text_pos, text_len) unread
+  uint64_t text_pos, text_len, text_size;
+#if ZLIB
+  z_stream z;                   // gzip: inflated serially
+  int z_end;
+  uint64_t *blocks, *block_out; // BGZF: blocks of the input inflated in parallel
+#endif
+} seq_stream_t;
+
 /**
   @param file Char array containing the filename
   @param data Char array which will contain all the contents of the array.
@@ -50,11 +84,79 @@
 int file_to_char(const char * file, char ** data);
 
 /**
-  @param fp Pointer to the file stream
-  @param line String where the data will be saved.
-  @return Size of the read sequence
+  @param data Char array containing a multi-FASTA collection. Headers and
+  line breaks are removed in place, so it ends up storing the concatenation
+  of all the sequences.
+  @param bounds Array with the starting position of each sequence, plus the
+  length of the concatenated text. It will be allocated inside the function
+  @param names Array with the name of each sequence (header without '>').
+  It will be allocated inside the function
+  @return Number of sequences in the collection. Negative if some error occurred.
+*/
+int fasta_to_collection(char * data, uint64_t ** bounds, char *** names);
+
+/**
+  Loads the sequences of a FASTA or FASTQ file (plain, gzip or BGZF) into
+  read arenas, parsing it in parallel
+  @param seq_file Name of the sequence file
+  @param begin First byte of the range of the file whose records are loaded
+  @param end End of the range (negative: end of file)
+  @param nthreads Number of parser threads
+  @param arenas Text of the sequences, one arena per part (allocated inside
+  the function, freed with arena_free() and free())
+  @param narenas Number of arenas
+  @param lines Pointer to each sequence (NUL-terminated), in file order
+  @param lines_len Length of each sequence
+  @param bases Total length of the sequences
+  @param bytes Size of the range (of the inflated text, if compressed)
+  @return Number of sequences
+*/
+uint load_sequences(const char *seq_file, long begin, long end, uint nthreads,
+                    read_arena_t **arenas, uint *narenas,
+                    char ***lines, uint **lines_len, uint64_t *bases, uint64_t *bytes);
+
+/**
+  Parses a FASTA or FASTQ record (header, sequence lines and, FASTQ, '+' and
+  quality lines) and appends its sequence to the arena
+  @param p First byte of the record
+  @param stop End of the data, which must be the end of a line
+  @param more Whether more input may follow stop
+  @param fastq Whether the file is FASTQ
+  @param name Name of the file (errors)
+  @param at Offset of p in the file (errors)
+  @param arena Arena receiving the sequence
+  @return Next record, or NULL if more input may follow and the record does
+  not end before stop
+*/
+const char *parse_record(const char *p, const char *stop, int more, int fastq,
+                         const char *name, uint64_t at, read_arena_t *arena);
+
+/**
+  @param arena Read arena whose mapping and arrays are released
+*/
+void arena_free(read_arena_t *arena);
+
+/**
+  Opens a sequence file, or the standard input ("-"), as a stream; its first
+  bytes tell whether it is plain, gzip or BGZF
+  @param s Stream
+  @param seq_file Name of the sequence file
+  @param nthreads Number of threads inflating BGZF blocks
+*/
+void seq_stream_open(seq_stream_t *s, const char *seq_file, uint nthreads);
+
+/**
+  @param s Stream
+  @param buf Buffer receiving the text (inflated if the input is compressed)
+  @param n Size of the buffer
+  @return Bytes read, 0 at the end of the input
+*/
+uint64_t seq_stream_read(seq_stream_t *s, char *buf, uint64_t n);
+
+/**
+  @param s Stream to close
 */
-long int read_seq_from_fasta(FILE * fp, char** line);
+void seq_stream_close(seq_stream_t *s);
 
 
 #endif
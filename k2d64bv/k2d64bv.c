@@ -78,6 +78,20 @@ k2_LF(unsigned char symbol, uint64_t idx)
     return count;
 }
 
+// k2 symbol stored at BWT row idx (-1 for the rows holding $)
+static __forceinline int
+k2_symbol(SFM_entry_t *entries, uint64_t idx)
+{
+    SFM_entry_t *entry = &entries[(idx / D_VAL)*K2_SYMBOLS];
+    uint64_t mask = 0x1LU << (63 - idx % D_VAL);
+
+    for (int c = 0; c < K2_SYMBOLS; c++)
+    {
+        if (entry[c].data & mask) return c;
+    }
+    return -1;
+}
+
 void
 init_C(uint64_t C[KSTEPS][SYMBOLS])
 {
@@ -341,6 +355,13 @@ int dump_SFM(SFM_t *fmi)
   printf("- len: %lu\n", fmi->len);
   printf("- alphabet: %s\n", fmi->alphabet);
   printf("- end_char_pos: %lu\n", fmi->end_char_pos[0]);
+  printf("- sequences: %u\n", fmi->n_seqs);
+  for(uint32_t i = 0; i < fmi->n_seqs; i++)
+    printf("  [%u] %s: %lu - %lu\n", i, fmi->seq_names[i], fmi->seq_bounds[i], fmi->seq_bounds[i+1]);
+  printf("- SA sampling rate: %u (%lu samples)\n", fmi->sa_rate, fmi->n_sa);
+  printf("- ISA sampling rate: %u (%lu samples)\n", fmi->isa_rate, fmi->n_isa);
+  printf("- packed text: %lu words\n", fmi->n_packed);
+  printf("- Bloom filter: %lu blocks, %u-mers, %u hashes\n", fmi->n_bloom, fmi->bloom_k, fmi->bloom_hashes);
   
   // C array
   dump_C_SFM(fmi->C);
@@ -390,7 +411,7 @@ int write_SFM(const char* file, SFM_t *fmi)
   }
 
   // Write prologue
-  fwrite(fmi->start, sizeof(char), 500, f);
+  fwrite(fmi->start, sizeof(char), SFM_START_LEN, f);
   fwrite(&fmi->len, sizeof(fmi->len), 1, f);
   fwrite(fmi->alphabet, sizeof(char), SYMBOLS, f);
   fwrite(fmi->end_char_pos, sizeof(uint64_t), KSTEPS, f);
@@ -414,6 +435,59 @@ int write_SFM(const char* file, SFM_t *fmi)
   uint lut_entries5 = pow(SYMBOLS, 5);
   fwrite(fmi->LUT[1], sizeof(LUT_entry_t), lut_entries5, f);
 
+  // Write optional sections: tag + data
+  uint32_t tag;
+  if (fmi->n_seqs > 0)
+  {
+    tag = SFM_SECTION_SEQS;
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&fmi->n_seqs, sizeof(fmi->n_seqs), 1, f);
+    fwrite(fmi->seq_bounds, sizeof(uint64_t), fmi->n_seqs+1, f);
+    for(uint32_t i = 0; i < fmi->n_seqs; i++)
+    {
+      uint32_t name_len = strlen(fmi->seq_names[i]);
+      fwrite(&name_len, sizeof(name_len), 1, f);
+      fwrite(fmi->seq_names[i], sizeof(char), name_len, f);
+    }
+  }
+
+  if (fmi->sa_rate > 0)
+  {
+    tag = SFM_SECTION_SA;
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&fmi->sa_rate, sizeof(fmi->sa_rate), 1, f);
+    fwrite(&fmi->n_sa, sizeof(fmi->n_sa), 1, f);
+    fwrite(fmi->sa_marks, sizeof(SFM_entry_t), ceil_uint_div(fmi->len, 64), f);
+    fwrite(fmi->sa, sizeof(uint64_t), fmi->n_sa, f);
+  }
+
+  if (fmi->isa_rate > 0)
+  {
+    tag = SFM_SECTION_ISA;
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&fmi->isa_rate, sizeof(fmi->isa_rate), 1, f);
+    fwrite(&fmi->n_isa, sizeof(fmi->n_isa), 1, f);
+    fwrite(fmi->isa, sizeof(uint64_t), fmi->n_isa, f);
+  }
+
+  if (fmi->n_packed > 0)
+  {
+    tag = SFM_SECTION_PACK;
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&fmi->n_packed, sizeof(fmi->n_packed), 1, f);
+    fwrite(fmi->packed, sizeof(uint64_t), fmi->n_packed, f);
+  }
+
+  if (fmi->n_bloom > 0)
+  {
+    tag = SFM_SECTION_BLOOM;
+    fwrite(&tag, sizeof(tag), 1, f);
+    fwrite(&fmi->bloom_k, sizeof(fmi->bloom_k), 1, f);
+    fwrite(&fmi->bloom_hashes, sizeof(fmi->bloom_hashes), 1, f);
+    fwrite(&fmi->n_bloom, sizeof(fmi->n_bloom), 1, f);
+    fwrite(fmi->bloom, sizeof(uint64_t), fmi->n_bloom*BLOOM_BLOCK_BITS/64, f);
+  }
+
   fclose(f);
   return 0;
 }
@@ -430,14 +504,14 @@ int load_SFM(const char* file, SFM_t * fmi)
   long fr;
 
   // Read 500 chars (TTGGATCTATGCTTCTGGT...)
-  fmi->start = malloc(sizeof(char)*501);
-  fr = fread(fmi->start, sizeof(char), 500, f);
-  if (fr != 500)
+  fmi->start = malloc(sizeof(char)*(SFM_START_LEN+1));
+  fr = fread(fmi->start, sizeof(char), SFM_START_LEN, f);
+  if (fr != SFM_START_LEN)
   {
     fprintf(stderr, "Error at fread(start)\n");
     return -1;
   }
-  fmi->start[500]=0;
+  fmi->start[SFM_START_LEN]=0;
 
   // Read prologue
   fr = fread(&fmi->len, sizeof(fmi->len), 1, f);
@@ -575,7 +649,140 @@ int load_SFM(const char* file, SFM_t * fmi)
     fprintf(stderr, "Error at fread (LUT5)\n");
     exit(1);
   }
+
+  // read optional sections
+  uint32_t tag;
+  fmi->n_seqs = 0;
+  fmi->seq_bounds = NULL;
+  fmi->seq_names = NULL;
+  fmi->sa_rate = 0;
+  fmi->n_sa = 0;
+  fmi->sa_marks = NULL;
+  fmi->sa = NULL;
+  fmi->isa_rate = 0;
+  fmi->n_isa = 0;
+  fmi->isa = NULL;
+  fmi->n_packed = 0;
+  fmi->packed = NULL;
+  fmi->n_bloom = 0;
+  fmi->bloom = NULL;
+
+  while (fread(&tag, sizeof(tag), 1, f) == 1)
+  {
+    switch (tag)
+    {
+      case SFM_SECTION_SEQS:
+        fr = fread(&fmi->n_seqs, sizeof(fmi->n_seqs), 1, f);
+        fmi->seq_bounds = malloc((fmi->n_seqs+1)*sizeof(uint64_t));
+        fmi->seq_names = malloc(fmi->n_seqs*sizeof(char*));
+        if ((fr != 1) || (fmi->seq_bounds == NULL) || (fmi->seq_names == NULL))
+        {
+          fprintf(stderr, "Error at fread (sequences)\n");
+          exit(1);
+        }
+        fr = fread(fmi->seq_bounds, sizeof(uint64_t), fmi->n_seqs+1, f);
+        if (fr != fmi->n_seqs+1)
+        {
+          fprintf(stderr, "Error at fread (sequence bounds)\n");
+          exit(1);
+        }
+        for(uint32_t i = 0; i < fmi->n_seqs; i++)
+        {
+          uint32_t name_len;
+          fr = fread(&name_len, sizeof(name_len), 1, f);
+          fmi->seq_names[i] = calloc(name_len+1, sizeof(char));
+          if ((fr != 1) || (fmi->seq_names[i] == NULL) ||
+              (fread(fmi->seq_names[i], sizeof(char), name_len, f) != name_len))
+          {
+            fprintf(stderr, "Error at fread (sequence names)\n");
+            exit(1);
+          }
+        }
+        break;
+
+      case SFM_SECTION_SA:
+      {
+        uint64_t n_words;
+        fr  = fread(&fmi->sa_rate, sizeof(fmi->sa_rate), 1, f);
+        fr += fread(&fmi->n_sa, sizeof(fmi->n_sa), 1, f);
+        n_words = ceil_uint_div(fmi->len, 64);
+        fmi->sa_marks = malloc(n_words*sizeof(SFM_entry_t));
+        fmi->sa = malloc(fmi->n_sa*sizeof(uint64_t));
+        if ((fr != 2) || (fmi->sa_marks == NULL) || (fmi->sa == NULL))
+        {
+          fprintf(stderr, "Error at fread (SA samples)\n");
+          exit(1);
+        }
+        if ((fread(fmi->sa_marks, sizeof(SFM_entry_t), n_words, f) != n_words) ||
+            (fread(fmi->sa, sizeof(uint64_t), fmi->n_sa, f) != fmi->n_sa))
+        {
+          fprintf(stderr, "Error at fread (SA samples)\n");
+          exit(1);
+        }
+        break;
+      }
+
+      case SFM_SECTION_ISA:
+        fr  = fread(&fmi->isa_rate, sizeof(fmi->isa_rate), 1, f);
+        fr += fread(&fmi->n_isa, sizeof(fmi->n_isa), 1, f);
+        fmi->isa = malloc(fmi->n_isa*sizeof(uint64_t));
+        if ((fr != 2) || (fmi->isa == NULL) ||
+            (fread(fmi->isa, sizeof(uint64_t), fmi->n_isa, f) != fmi->n_isa))
+        {
+          fprintf(stderr, "Error at fread (ISA samples)\n");
+          exit(1);
+        }
+        break;
+
+      case SFM_SECTION_PACK:
+        fr = fread(&fmi->n_packed, sizeof(fmi->n_packed), 1, f);
+        fmi->packed = malloc(fmi->n_packed*sizeof(uint64_t));
+        if ((fr != 1) || (fmi->packed == NULL) ||
+            (fread(fmi->packed, sizeof(uint64_t), fmi->n_packed, f) != fmi->n_packed))
+        {
+          fprintf(stderr, "Error at fread (packed text)\n");
+          exit(1);
+        }
+        break;
+
+      case SFM_SECTION_BLOOM:
+      {
+        uint64_t n_words;
+        fr  = fread(&fmi->bloom_k, sizeof(fmi->bloom_k), 1, f);
+        fr += fread(&fmi->bloom_hashes, sizeof(fmi->bloom_hashes), 1, f);
+        fr += fread(&fmi->n_bloom, sizeof(fmi->n_bloom), 1, f);
+        n_words = fmi->n_bloom*BLOOM_BLOCK_BITS/64;
+        // a block per cache line
+        fmi->bloom = aligned_alloc(BLOOM_BLOCK_BITS/8, n_words*sizeof(uint64_t));
+        if ((fr != 3) || (fmi->bloom == NULL) ||
+            (fread(fmi->bloom, sizeof(uint64_t), n_words, f) != n_words))
+        {
+          fprintf(stderr, "Error at fread (Bloom filter)\n");
+          exit(1);
+        }
+        break;
+      }
+
+      default:
+        fprintf(stderr, "Unknown section 0x%x in file %s\n", tag, file);
+        exit(1);
+    }
+  }
   fclose(f);
+
+  // Data initializing (locate)
+  pfmi = fmi;
+  ROcc = fmi->entries;
+  mask_init(mask_64b);
+
+  // last_char is not stored: the suffix "c1$" adds one row to C[c1*4]
+  fmi->last_char = 0;
+  for (uint c = 1; c < SYMBOLS; c++)
+  {
+    uint sym = c*SYMBOLS - 1;
+    if (fmi->C[sym+1] - fmi->C[sym] > k2_LF(sym, fmi->len) - k2_LF(sym, 0))
+      fmi->last_char = c;
+  }
   return 0;
 }
 
@@ -606,6 +813,9 @@ count_SFM(SFM_t *fmi, const char* seq, uint len, uint64_t * start, uint64_t * en
       ch = ch1 + (ch2 << BITS_PER_SYMBOL);
       *start = fmi->C[(uint)ch];
       *end   = fmi->C[ch+1];
+      // the suffix "c1$" precedes the suffixes c1c (c1: last char)
+      if (ch + 1 == fmi->last_char*4)
+        (*end)--;
     }
     else
     { // Search the last character individually
@@ -614,6 +824,8 @@ count_SFM(SFM_t *fmi, const char* seq, uint len, uint64_t * start, uint64_t * en
       *end   = fmi->C[(ch+1)*4];
       if (ch == fmi->last_char)
         (*start)--;
+      else if (ch + 1 == fmi->last_char)
+        (*end)--;
     }
 
     for(int i=step_len-1; i>=0; i--)
@@ -631,6 +843,22 @@ count_SFM(SFM_t *fmi, const char* seq, uint len, uint64_t * start, uint64_t * en
     return 0;
 }
 
+void
+extend_SFM(SFM_t *fmi, uint64_t start, uint64_t end, uint64_t *starts, uint64_t *ends)
+{
+    // the K2_SYMBOLS entries of a row are contiguous: 2 x 256 bytes
+    SFM_entry_t *start_bl = &fmi->entries[(start/D_VAL)*K2_SYMBOLS];
+    SFM_entry_t *end_bl   = &fmi->entries[(end/D_VAL)*K2_SYMBOLS];
+    uint64_t start_mask = mask_64b[start % D_VAL];
+    uint64_t end_mask   = mask_64b[end % D_VAL];
+
+    for (uint c = 0; c < K2_SYMBOLS; c++)
+    {
+      starts[c] = start_bl[c].counter + _popcnt64(start_bl[c].data & start_mask);
+      ends[c]   = end_bl[c].counter   + _popcnt64(end_bl[c].data & end_mask);
+    }
+}
+
 int
 generate_SFM_encoding_table2(SFM_t *fmi, uint8_t** out)
 {
@@ -685,6 +913,372 @@ generate_SFM_LUT(SFM_t * fmi, uint n_chars, LUT_entry_t ** LUT)
   return 0;
 }
 
+int
+generate_SFM_SA(SFM_t *fmi, int64_t *SA, uint rate)
+{
+  uint64_t n_words = ceil_uint_div(fmi->len, 64);
+
+  fmi->sa_rate = rate;
+  fmi->n_sa = 0;
+  fmi->sa_marks = calloc(n_words, sizeof(SFM_entry_t));
+  if (fmi->sa_marks == NULL)
+  {
+    fprintf(stderr, "Error at SA samples malloc.\n");
+    return -1;
+  }
+
+  // mark sampled rows: walking back KSTEPS positions per LF,
+  // any row reaches a sample in less than rate/KSTEPS steps
+  for(uint64_t i = 0; i < fmi->len; i++)
+  {
+    if (SA[i] % rate < KSTEPS)
+    {
+      fmi->sa_marks[i/64].data |= 0x1LU << (63 - i % 64);
+      fmi->n_sa++;
+    }
+  }
+
+  fmi->sa = malloc(fmi->n_sa*sizeof(uint64_t));
+  if (fmi->sa == NULL)
+  {
+    fprintf(stderr, "Error at SA samples malloc.\n");
+    return -1;
+  }
+
+  uint64_t n_sa = 0;
+  for(uint64_t i = 0; i < fmi->len; i++)
+  {
+    if (i % 64 == 0)
+      fmi->sa_marks[i/64].counter = n_sa;
+    if (SA[i] % rate < KSTEPS)
+      fmi->sa[n_sa++] = SA[i];
+  }
+  return 0;
+}
+
+uint64_t
+locate_SFM(SFM_t *fmi, const uint64_t *rows, uint64_t *pos, uint n)
+{
+  uint64_t row[LOCATE_NSEQS], walked = 0;
+  uint req[LOCATE_NSEQS], steps[LOCATE_NSEQS];
+  uint next = 0, active = 0;
+
+  // LF walks of several rows are interleaved to overlap their memory accesses
+  for(uint j = 0; j < LOCATE_NSEQS; j++)
+  {
+    if (next < n)
+    {
+      row[j] = rows[next];
+      req[j] = next++;
+      steps[j] = 0;
+      active++;
+      _mm_prefetch((char*) &fmi->sa_marks[row[j]/64], PREFETCH_HINT_L2);
+      _mm_prefetch((char*) &fmi->entries[(row[j]/D_VAL)*K2_SYMBOLS], PREFETCH_HINT_L2);
+    }
+    else
+      req[j] = n;
+  }
+
+  while (active > 0)
+  {
+    for(uint j = 0; j < LOCATE_NSEQS; j++)
+    {
+      if (req[j] == n) continue;
+
+      uint64_t r = row[j];
+      SFM_entry_t *mark = &fmi->sa_marks[r/64];
+      if (mark->data & (0x1LU << (63 - r % 64)))
+      {
+        // sampled row
+        uint64_t idx = mark->counter + _popcnt64(mark->data & mask_64b[r % 64]);
+        pos[req[j]] = fmi->sa[idx] + steps[j]*KSTEPS;
+        if (next < n)
+        {
+          row[j] = rows[next];
+          req[j] = next++;
+          steps[j] = 0;
+        }
+        else
+        {
+          req[j] = n;
+          active--;
+          continue;
+        }
+      }
+      else
+      {
+        // rows holding $ are always sampled
+        int c = k2_symbol(fmi->entries, r);
+        SFM_entry_t *entry = &fmi->entries[(r/D_VAL)*K2_SYMBOLS + c];
+        row[j] = entry->counter + _popcnt64(entry->data & mask_64b[r % D_VAL]);
+        steps[j]++;
+        walked++;
+      }
+      _mm_prefetch((char*) &fmi->sa_marks[row[j]/64], PREFETCH_HINT_L2);
+      _mm_prefetch((char*) &fmi->entries[(row[j]/D_VAL)*K2_SYMBOLS], PREFETCH_HINT_L2);
+    }
+  }
+  return walked;
+}
+
+int
+generate_SFM_ISA(SFM_t *fmi, int64_t *SA, uint rate)
+{
+  uint64_t n = fmi->len - 1;  // text length
+
+  fmi->isa_rate = rate;
+  fmi->n_isa = ceil_uint_div(n, rate);
+  fmi->isa = malloc(fmi->n_isa*sizeof(uint64_t));
+  if (fmi->isa == NULL)
+  {
+    fprintf(stderr, "Error at ISA samples malloc.\n");
+    return -1;
+  }
+
+  for(uint64_t i = 0; i < fmi->len; i++)
+  {
+    if (((uint64_t) SA[i] < n) && (SA[i] % rate == 0))
+      fmi->isa[SA[i]/rate] = i;
+  }
+  return 0;
+}
+
+int
+extract_SFM(SFM_t *fmi, const uint64_t *pos, const uint *len, char **out, uint n)
+{
+  uint64_t text_len = fmi->len - 1;
+  uint64_t row[LOCATE_NSEQS], cur[LOCATE_NSEQS], lo[LOCATE_NSEQS];
+  uint req[LOCATE_NSEQS];
+  uint next = 0, active = 0;
+
+  for(uint k = 0; k < n; k++)
+  {
+    if (pos[k] + len[k] > text_len) return -1;
+    out[k][len[k]] = 0;
+  }
+
+  // LF walks of several substrings are interleaved to overlap their memory accesses
+  while (1)
+  {
+    while ((active < LOCATE_NSEQS) && (next < n))
+    {
+      // new substring: the prefix stored in the index is copied
+      uint k = next++;
+      uint64_t hi = pos[k] + len[k];
+      uint64_t q;
+
+      if (pos[k] < SFM_START_LEN)
+        memcpy(out[k], fmi->start + pos[k], (hi < SFM_START_LEN ? hi : SFM_START_LEN) - pos[k]);
+      if (hi <= SFM_START_LEN) continue;
+
+      // first sampled suffix after the substring (the suffix $ is row 0)
+      q = ceil_uint_div(hi, fmi->isa_rate)*fmi->isa_rate;
+      if (q >= text_len)
+      {
+        q = text_len;
+        row[active] = 0;
+      }
+      else
+        row[active] = fmi->isa[q/fmi->isa_rate];
+      cur[active] = q;
+      lo[active] = (pos[k] > SFM_START_LEN) ? pos[k] : SFM_START_LEN;
+      req[active] = k;
+      _mm_prefetch((char*) &fmi->entries[(row[active]/D_VAL)*K2_SYMBOLS], PREFETCH_HINT_L2);
+      active++;
+    }
+    if (active == 0) break;
+
+    for(uint j = 0; j < active; )
+    {
+      // the row of the suffix cur is preceded by T[cur-2] T[cur-1]
+      uint64_t r = row[j], p = cur[j] - KSTEPS;
+      uint k = req[j];
+      int c = k2_symbol(fmi->entries, r);
+
+      if ((p >= lo[j]) && (p < pos[k] + len[k]))
+        out[k][p - pos[k]] = fmi->alphabet[c >> BITS_PER_SYMBOL];
+      if ((p + 1 >= lo[j]) && (p + 1 < pos[k] + len[k]))
+        out[k][p + 1 - pos[k]] = fmi->alphabet[c & (SYMBOLS - 1)];
+
+      if (p <= lo[j])
+      {
+        // finished: the last walk takes its slot
+        active--;
+        row[j] = row[active];
+        cur[j] = cur[active];
+        lo[j]  = lo[active];
+        req[j] = req[active];
+        continue;
+      }
+
+      SFM_entry_t *entry = &fmi->entries[(r/D_VAL)*K2_SYMBOLS + c];
+      row[j] = entry->counter + _popcnt64(entry->data & mask_64b[r % D_VAL]);
+      cur[j] = p;
+      _mm_prefetch((char*) &fmi->entries[(row[j]/D_VAL)*K2_SYMBOLS], PREFETCH_HINT_L2);
+      j++;
+    }
+  }
+  return 0;
+}
+
+int
+generate_SFM_packed(SFM_t *fmi, const char *data)
+{
+  uint64_t n = fmi->len - 1;  // text length
+
+  // one extra word: any 32-char window is inside two words
+  fmi->n_packed = n/32 + 2;
+  fmi->packed = calloc(fmi->n_packed, sizeof(uint64_t));
+  if (fmi->packed == NULL)
+  {
+    fprintf(stderr, "Error at packed text malloc.\n");
+    return -1;
+  }
+
+  for(uint64_t i = 0; i < n; i++)
+    fmi->packed[i/32] |= (uint64_t) fmi->encoding_table[(uint8_t) data[i]] << (2*(i % 32));
+  return 0;
+}
+
+// hashes of a k-mer (2-bit symbols): block of the Bloom filter and positions
+// of its bits in the block, 9 bits each
+static __forceinline uint64_t
+bloom_mix(uint64_t x)
+{
+  x ^= x >> 33;
+  x *= 0xff51afd7ed558ccdUL;
+  x ^= x >> 33;
+  x *= 0xc4ceb9fe1a85ec53UL;
+  x ^= x >> 33;
+  return x;
+}
+
+static __forceinline uint64_t *
+bloom_block(SFM_t *fmi, uint64_t kmer, uint64_t *bits)
+{
+  uint64_t h = bloom_mix(kmer);
+  *bits = bloom_mix(h ^ 0x9e3779b97f4a7c15UL);
+  return &fmi->bloom[(uint64_t)(((unsigned __int128) h*fmi->n_bloom) >> 64)*(BLOOM_BLOCK_BITS/64)];
+}
+
+int
+generate_SFM_bloom(SFM_t *fmi, const char *data, uint k, uint bits)
+{
+  uint64_t n = fmi->len - 1;  // text length
+  uint64_t mask = (k < 32)? (1UL << (2*k)) - 1 : ~0UL, kmer = 0;
+  uint64_t n_kmers = (n >= k)? n - k + 1 : 1;
+
+  fmi->bloom_k = k;
+  // optimal number of hash functions: bits per k-mer x ln 2
+  fmi->bloom_hashes = (uint32_t)(bits*0.693 + 0.5);
+  if (fmi->bloom_hashes < 1) fmi->bloom_hashes = 1;
+  if (fmi->bloom_hashes > BLOOM_MAX_HASHES) fmi->bloom_hashes = BLOOM_MAX_HASHES;
+  fmi->n_bloom = ceil_uint_div(n_kmers*bits, BLOOM_BLOCK_BITS);
+  fmi->bloom = aligned_alloc(BLOOM_BLOCK_BITS/8, fmi->n_bloom*(BLOOM_BLOCK_BITS/8));
+  if (fmi->bloom == NULL)
+  {
+    fprintf(stderr, "Error at Bloom filter malloc.\n");
+    return -1;
+  }
+  memset(fmi->bloom, 0, fmi->n_bloom*(BLOOM_BLOCK_BITS/8));
+
+  for(uint64_t i = 0; i < n; i++)
+  {
+    kmer = ((kmer << 2) | fmi->encoding_table[(uint8_t) data[i]]) & mask;
+    if (i + 1 < k) continue;
+    uint64_t h, *block = bloom_block(fmi, kmer, &h);
+    for (uint j = 0; j < fmi->bloom_hashes; j++, h >>= 9)
+      block[(h & 511)/64] |= 1UL << (h % 64);
+  }
+  return 0;
+}
+
+int
+bloom_SFM(SFM_t *fmi, const char *seq, uint len, uint n)
+{
+  uint k = fmi->bloom_k;
+  uint64_t mask = (k < 32)? (1UL << (2*k)) - 1 : ~0UL;
+
+  if (len < k) return 1;
+  for (uint i = 0; i < n; i++)
+  {
+    // k-mers at both ends and evenly spaced in between
+    uint pos = (n > 1)? (uint)((uint64_t) i*(len - k)/(n - 1)) : len - k;
+    uint64_t kmer = 0, h, *block;
+    for (uint j = pos; j < pos + k; j++)
+      kmer = (kmer << 2) | fmi->encoding_table[(uint8_t) seq[j]];
+    block = bloom_block(fmi, kmer & mask, &h);
+    for (uint j = 0; j < fmi->bloom_hashes; j++, h >>= 9)
+      if (!(block[(h & 511)/64] & (1UL << (h % 64)))) return 0;
+  }
+  return 1;
+}
+
+// packs 8 chars (ACGT) of a 64-bit word into 16 bits, first char in the LSBs
+static __forceinline uint64_t
+pack8_ACGT(uint64_t x)
+{
+  // A,C,G,T = 0x41,0x43,0x47,0x54: (x >> 1) & 3 = 0,1,3,2
+  x = (x >> 1) & 0x0303030303030303LU;
+  x ^= (x >> 1) & 0x0101010101010101LU;
+  x = (x | (x >> 6))  & 0x000F000F000F000FLU;
+  x = (x | (x >> 12)) & 0x000000FF000000FFLU;
+  x = (x | (x >> 24)) & 0x000000000000FFFFLU;
+  return x;
+}
+
+int
+compare_SFM(SFM_t *fmi, uint64_t pos, const char *seq, uint len)
+{
+  int acgt = (strncmp(fmi->alphabet, "ACGT", SYMBOLS) == 0);
+
+  // 32 characters per step, compared as 64-bit words
+  for(uint i = 0; i < len; i += 32)
+  {
+    uint n = (len - i < 32) ? len - i : 32;
+    uint64_t p = pos + i, off = 2*(p % 32);
+    uint64_t text = fmi->packed[p/32] >> off;
+    uint64_t code = 0, mask;
+
+    if (off > 0)
+      text |= fmi->packed[p/32 + 1] << (64 - off);
+
+    if (acgt)
+    {
+      for(uint k = 0; k < n; k += 8)
+      {
+        uint64_t chars = 0;
+        memcpy(&chars, seq + i + k, (n - k < 8) ? n - k : 8);
+        code |= pack8_ACGT(chars) << (2*k);
+      }
+    }
+    else
+    {
+      for(uint k = 0; k < n; k++)
+        code |= (uint64_t) fmi->encoding_table[(uint8_t) seq[i+k]] << (2*k);
+    }
+
+    mask = (n == 32) ? ~0LU : (0x1LU << (2*n)) - 1;
+    if ((text ^ code) & mask) return 0;
+  }
+  return 1;
+}
+
+uint32_t
+seq_of_pos_SFM(SFM_t *fmi, uint64_t pos)
+{
+  uint32_t lo = 0, hi = fmi->n_seqs;
+
+  // largest i such that seq_bounds[i] <= pos
+  while (hi - lo > 1)
+  {
+    uint32_t mid = (lo + hi)/2;
+    if (fmi->seq_bounds[mid] <= pos) lo = mid;
+    else                             hi = mid;
+  }
+  return lo;
+}
+
 void
 free_SFM(SFM_t * fmi)
 {
@@ -702,4 +1296,13 @@ free_SFM(SFM_t * fmi)
   free(fmi->C);
   free(fmi->LUT[0]);
   free(fmi->LUT[1]);
+  for(uint32_t i = 0; i < fmi->n_seqs; i++)
+    free(fmi->seq_names[i]);
+  free(fmi->seq_names);
+  free(fmi->seq_bounds);
+  free(fmi->sa_marks);
+  free(fmi->sa);
+  free(fmi->isa);
+  free(fmi->packed);
+  free(fmi->bloom);
 }
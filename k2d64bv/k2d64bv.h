@@ -74,6 +74,26 @@ typedef struct LUT_entry {
   uint32_t end;
 } LUT_entry_t;
 
+// optional sections appended to the fm-index file
+#define SFM_SECTION_SEQS  0x53514553  // 'SEQS': collection of sequences
+#define SFM_SECTION_SA    0x53414d53  // 'SAMS': suffix array samples
+#define SFM_SECTION_ISA   0x53415349  // 'ISAS': inverse suffix array samples
+#define SFM_SECTION_PACK  0x4b434150  // 'PACK': 2-bit packed text
+#define SFM_SECTION_BLOOM 0x4d4f4c42  // 'BLOM': Bloom filter of the k-mers
+
+// Bloom filter: bits per block (a cache line) and hash functions (9 bits each)
+#define BLOOM_BLOCK_BITS  512
+#define BLOOM_MAX_HASHES  7
+
+// default SA sampling rate for collections
+#define SA_SAMPLING_RATE  32
+
+// interleaved LF walks when locating and extracting
+#define LOCATE_NSEQS      16
+
+// characters of the text stored in the index (SFM_t.start)
+#define SFM_START_LEN     500
+
 typedef struct SFM_Index {
   uint64_t len;     // BWT lenght
   char * start;     // first 500-char of raw data
@@ -86,6 +106,27 @@ typedef struct SFM_Index {
   uint8_t * encoding_table;   // 1-char step encoding table
   uint8_t * encoding_table2;  // 2-char step encoding table
   LUT_entry_t * LUT[KSTEPS];  // 5 and 6 characters LUTs
+  // collection of sequences (n_seqs = 0: single reference)
+  uint32_t n_seqs;
+  uint64_t * seq_bounds;      // starting position of each sequence (+ text length)
+  char ** seq_names;
+  // suffix array samples (sa_rate = 0: not sampled)
+  uint32_t sa_rate;           // text positions p with p % sa_rate < KSTEPS are sampled
+  uint64_t n_sa;
+  SFM_entry_t * sa_marks;     // sampled rows: counter = rank, data = bitmap
+  uint64_t * sa;              // sampled SA values, in row order
+  // inverse suffix array samples (isa_rate = 0: not sampled)
+  uint32_t isa_rate;
+  uint64_t n_isa;
+  uint64_t * isa;             // isa[k]: row of the suffix k*isa_rate
+  // 2-bit packed text (n_packed = 0: not stored)
+  uint64_t n_packed;
+  uint64_t * packed;          // 32 chars per word, first char in the LSBs
+  // blocked Bloom filter of the k-mers of the text (n_bloom = 0: not stored)
+  uint32_t bloom_k;           // k-mer length (up to 32)
+  uint32_t bloom_hashes;      // bits set per k-mer, all in the same block
+  uint64_t n_bloom;           // blocks of BLOOM_BLOCK_BITS bits
+  uint64_t * bloom;
 } SFM_t;
 
 void init_C(uint64_t C[KSTEPS][SYMBOLS]);
@@ -123,6 +164,14 @@ int dump_SFM(SFM_t *fmi);
 
 int count_SFM(SFM_t *fmi, const char* orig_seq, uint len, uint64_t * start, uint64_t* end);
 
+/**
+  @param fmi FMIndex
+  @param start,end BWT interval [start, end) of a sequence S
+  @param starts,ends Intervals [starts[c], ends[c]) of the sequences cS for
+         every k2 symbol c (output, K2_SYMBOLS elements)
+*/
+void extend_SFM(SFM_t *fmi, uint64_t start, uint64_t end, uint64_t *starts, uint64_t *ends);
+
 /**
   @param file Char array containing the filename
   @param fmi FMIndex to load
@@ -134,6 +183,83 @@ int generate_SFM_encoding_table(SFM_t *fmi, uint8_t** out);
 
 int generate_SFM_encoding_table2(SFM_t *fmi, uint8_t** out);
 
+/**
+  @param fmi FMIndex
+  @param SA Suffix array of the text (fmi->len elements)
+  @param rate Sampling rate, multiple of KSTEPS
+  @return 0 if no error appeared.
+*/
+int generate_SFM_SA(SFM_t *fmi, int64_t *SA, uint rate);
+
+/**
+  @param fmi FMIndex with suffix array samples
+  @param rows BWT rows to locate
+  @param pos Text positions of the rows (output)
+  @param n Number of rows
+  @return LF steps of the walks (one per k2 step of a row)
+*/
+uint64_t locate_SFM(SFM_t *fmi, const uint64_t *rows, uint64_t *pos, uint n);
+
+/**
+  @param fmi FMIndex
+  @param SA Suffix array of the text (fmi->len elements)
+  @param rate Sampling rate, multiple of KSTEPS
+  @return 0 if no error appeared.
+*/
+int generate_SFM_ISA(SFM_t *fmi, int64_t *SA, uint rate);
+
+/**
+  @param fmi FMIndex with inverse suffix array samples
+  @param pos First text position of each substring
+  @param len Length of each substring
+  @param out Substrings (output, len+1 chars each, 0-terminated)
+  @param n Number of substrings
+  @return 0 if no error appeared, -1 if a substring exceeds the text.
+*/
+int extract_SFM(SFM_t *fmi, const uint64_t *pos, const uint *len, char **out, uint n);
+
+/**
+  @param fmi FMIndex
+  @param data Text (fmi->len - 1 characters)
+  @return 0 if no error appeared.
+*/
+int generate_SFM_packed(SFM_t *fmi, const char *data);
+
+/**
+  @param fmi FMIndex
+  @param data Text (fmi->len - 1 characters)
+  @param k Length of the k-mers (up to 32)
+  @param bits Bits of the filter per k-mer of the text
+  @return 0 if no error appeared.
+*/
+int generate_SFM_bloom(SFM_t *fmi, const char *data, uint k, uint bits);
+
+/**
+  @param fmi FMIndex with Bloom filter
+  @param seq Sequence
+  @param len Sequence length
+  @param n Number of k-mers tested, evenly spaced along the sequence
+  @return 0 if a k-mer of seq is not in the text (seq has no occurrences),
+          1 if it may occur (or is shorter than the k-mers).
+*/
+int bloom_SFM(SFM_t *fmi, const char *seq, uint len, uint n);
+
+/**
+  @param fmi FMIndex with packed text
+  @param pos Text position
+  @param seq Sequence
+  @param len Sequence length (pos + len must not exceed the text)
+  @return 1 if the text at pos matches seq, 0 otherwise.
+*/
+int compare_SFM(SFM_t *fmi, uint64_t pos, const char *seq, uint len);
+
+/**
+  @param fmi FMIndex storing a collection
+  @param pos Text position
+  @return Sequence of the collection that contains pos
+*/
+uint32_t seq_of_pos_SFM(SFM_t *fmi, uint64_t pos);
+
 void free_SFM(SFM_t * fmi);
 
 #endif
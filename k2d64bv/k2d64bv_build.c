@@ -36,16 +36,91 @@
  */
  
 #include <stdio.h>
+#include <stdlib.h>
 #include <math.h>
 #include <time.h>
 #include <sys/time.h>
 #include <string.h>
+#include <getopt.h>
+#include <limits.h>
+#include <libgen.h>
 
+#include "../aux.h"
 #include "../file_mng.h"
 #include "../BWT.h"
 #include "../bit_mng.h"
 #include "k2d64bv.h"
 
+// default bits per k-mer of the Bloom filter (-b k:bits)
+#define BLOOM_BITS 10
+
+#define _STR(x) #x
+#define STR(x)  _STR(x)
+
+// optional data stored in the fm-index
+typedef struct build_opts {
+  uint sa_rate;     // suffix array sampling rate (0: none)
+  uint isa_rate;    // inverse suffix array sampling rate (0: none)
+  int packed;       // 2-bit packed text
+  uint bloom_k;     // Bloom filter of the k-mers (0: none)
+  uint bloom_bits;  // bits per k-mer
+  int verbose;
+} build_opts_t;
+
+// input options
+static const char *optString = "s:i:pb:S:l:vh?";
+static const struct option longOpts[] =
+{
+    {"sa-sample", required_argument,  NULL,   's'},
+    {"isa-sample", required_argument, NULL,   'i'},
+    {"packed",    no_argument,        NULL,   'p'},
+    {"bloom",     required_argument,  NULL,   'b'},
+    {"shards",    required_argument,  NULL,   'S'},
+    {"overlap",   required_argument,  NULL,   'l'},
+    {"verbose",   no_argument,        NULL,   'v'},
+    {"help",      no_argument,        NULL,   'h'},
+    {NULL,                  0,        NULL,    0 }
+};
+/*----------------------------------------------------------------------------*/
+
+static struct option_help {
+    const char *long_opt, *short_opt, *desc;
+} opts_help[] = {
+    { "--sa-sample", "-s",
+      "store suffix array samples every rate positions (collections: 32 by default)" },
+    { "--isa-sample", "-i",
+      "store inverse suffix array samples every rate positions (substring extraction)" },
+    { "--packed", "-p",
+      "store the text 2-bit packed (fcount -u)" },
+    { "--bloom", "-b",
+      "store a Bloom filter of the k-mers of the text: k[:bits per k-mer] (fcount -F,\n"
+      "     k up to 32, default " STR(BLOOM_BITS) " bits)" },
+    { "--shards", "-S",
+      "split the reference into n overlapping shards, one fm-index each" },
+    { "--overlap", "-l",
+      "shard overlap, at least the maximum read length (default 1000)" },
+    { "--verbose", "-v",
+      "dump the intermediate data structures" },
+    { "--help", "-h",
+      "show program usage"},
+    { NULL, NULL, NULL }
+};
+
+static void
+show_usage(const char *name, int exit_code)
+{
+    struct option_help *h;
+
+    printf("usage: %s [options] reference_file\n", name);
+    printf("  reference_file: raw text, or multi-FASTA file with a collection of sequences\n");
+    for (h = opts_help; h->long_opt; h++)
+    {
+        printf(" %s, %s\n ", h->short_opt, h->long_opt);
+        printf("    %s\n", h->desc);
+    }
+    exit(exit_code);
+}
+
 /* return wall time in seconds */
 static double
 get_wall_time()
@@ -57,62 +132,31 @@ get_wall_time()
     return (double)time.tv_sec + (double)time.tv_usec * .000001;
 }
 
-int
-main(int argc, const char *argv[])
+/* builds the fm-index of data (released inside) and writes it to outfile */
+static int
+build_SFM(char *data, SFM_t *fmi, const build_opts_t *opts, const char *outfile)
 {
-  char * data;
-  uint64_t data_len;
   char ** bwt;
   char * unique_data;
-  char outfile[80];
   uint8_t ** reduced;
-  SFM_t fmi;
   uint n_bits;
   uint64_t *end;
   int64_t reduced_len;
   uint64_t C[KSTEPS][SYMBOLS];
+  uint64_t data_len = strlen(data);
   double wall_0, wall_1;
   int n, unique_len;
-  int verbose = 0;
-
-  if (argc < 2)
-  {
-    fprintf(stderr, "Use: ./%s file\n", argv[0]);
-    return 0;
-  }
-  if (argc == 3)
-    verbose = 1;
-
-  printf("Reading FM-index file %s... ", argv[1]);
-  wall_0 = get_wall_time();
-  n = file_to_char(argv[1], &data);
-  if (n < 0) exit(1);
-  data_len = strlen(data);
-  wall_1 = get_wall_time();
-  printf("OK\n");
-  printf("Total time: %.3fs\n", wall_1 - wall_0);
-  if (verbose)
-  {
-      printf("Reference text");
-      dump_array(data, data_len);
-  }
-  /*--------------------------------------------------------------------------*/
-
-  // init_C(C);
-  // build_C(&C[0][0], data, data_len);
-  // printf("---C Array---(%lu elements)\n", data_len);
-  // dump_C(C);
-  /*--------------------------------------------------------------------------*/
+  int64_t *SA = NULL;
 
   printf("Getting BWT of %lu characters... \n", data_len);
   wall_0 = get_wall_time();
-  n = get_bwt(&data, &bwt, data_len, KSTEPS, &end);
-  if (n < 0) exit(1);
+  n = get_bwt(&data, &bwt, data_len, KSTEPS, &end, (opts->sa_rate > 0) || (opts->isa_rate > 0) ? &SA : NULL);
+  if (n < 0) return -1;
   data_len++;  // $ character
   wall_1 = get_wall_time();
   printf("OK\nBWT Generated. Length: %lu\n", data_len);
   printf("Total time: %.3fs\n", wall_1 - wall_0);
-  if (verbose)
+  if (opts->verbose)
   {
       dump_BWT(bwt, KSTEPS, data_len);
       for (int i = 0; i < KSTEPS; i++) printf("- end[%d] = %lu\n", i, end[i]);
@@ -130,8 +174,13 @@ main(int argc, const char *argv[])
   printf("Encoding BWT...\n");
   wall_0 = get_wall_time();
   unique_len = get_unique_elements(bwt[0], &unique_data, data_len);
-  if (unique_len < 0) exit(1);
+  if (unique_len < 0) return -1;
 
+  if (unique_len != SYMBOLS)
+  {
+    fprintf(stderr, "Error: the text must contain the %d symbols (%d found)\n", SYMBOLS, unique_len);
+    return -1;
+  }
   n_bits = (uint)(ceil(log2(unique_len)));
   printf(" -> %d Unique elements. Each character can be stored in %u bits\n", unique_len, n_bits);
   // dump_array(unique_data, unique_len);
@@ -143,7 +192,7 @@ main(int argc, const char *argv[])
   wall_1 = get_wall_time();
   printf("OK, encoded BWT\n");
   printf("Total time: %.3fs\n", wall_1 - wall_0);
-  if (verbose)
+  if (opts->verbose)
   {
       dump_encoded_BWT(bwt, KSTEPS, data_len, unique_data, end);
       for (int i = 0; i < KSTEPS; i++) printf("- end[%d] = %lu\n", i, end[i]);
@@ -165,7 +214,7 @@ main(int argc, const char *argv[])
   printf("Compressing BWT... ");
   wall_0 = get_wall_time();
   reduced_len = reduce_bwt(bwt, data_len, n_bits, &reduced, KSTEPS);
-  if (reduced_len < 0) exit(1);
+  if (reduced_len < 0) return -1;
   wall_1 = get_wall_time();
   printf("OK\n -> Compression ratio: %.2f = %lu / %lu (original/compressed bytes)\n",
           (float) data_len / (reduced_len*KSTEPS), data_len, reduced_len*KSTEPS);
@@ -175,22 +224,273 @@ main(int argc, const char *argv[])
 
   printf("Generating FM-index... ");
   wall_0 = get_wall_time();
-  fmi.start = malloc(sizeof(char)*501);
-  memcpy(fmi.start, data, 500);
-  fmi.start[500] = 0;
-  free(data);
+  fmi->start = malloc(sizeof(char)*(SFM_START_LEN+1));
+  // short texts (shards overlaps) are padded with 0s
+  strncpy(fmi->start, data, SFM_START_LEN);
+  fmi->start[SFM_START_LEN] = 0;
   // dump_array(unique_data, unique_len);
-  generate_SFM(&fmi, reduced, data_len, unique_data, 64, end);
+  generate_SFM(fmi, reduced, data_len, unique_data, 64, end);
+  if (opts->sa_rate > 0)
+  {
+    if (generate_SFM_SA(fmi, SA, opts->sa_rate) < 0) return -1;
+  }
+  if (opts->isa_rate > 0)
+  {
+    if (generate_SFM_ISA(fmi, SA, opts->isa_rate) < 0) return -1;
+  }
+  free(SA);
+  if (opts->packed)
+  {
+    if (generate_SFM_packed(fmi, data) < 0) return -1;
+  }
+  if (opts->bloom_k > 0)
+  {
+    if (generate_SFM_bloom(fmi, data, opts->bloom_k, opts->bloom_bits) < 0) return -1;
+  }
+  free(data);
 
-  if (verbose) dump_SFM(&fmi);
+  if (opts->verbose) dump_SFM(fmi);
 
-  snprintf(outfile, sizeof(outfile), "%s.k%dd%dbv.fmi", argv[1], KSTEPS, D_VAL);
-  write_SFM(outfile, &fmi);
+  if (write_SFM(outfile, fmi) < 0) return -1;
   wall_1 = get_wall_time();
   printf("OK -> FM-index written to file %s\n", outfile);
+  if (fmi->n_bloom > 0)
+  {
+    // false positive rate of a k-mer not in the text: a set bit for every hash
+    uint64_t set = 0, n_words = fmi->n_bloom*BLOOM_BLOCK_BITS/64;
+    for (uint64_t i = 0; i < n_words; i++)
+      set += __builtin_popcountl(fmi->bloom[i]);
+    printf(" -> Bloom filter: %u-mers, %.1fKiB, %u hashes, %.1f%% bits set (false positives ~%.2f%%)\n",
+           fmi->bloom_k, n_words*8.0/1024, fmi->bloom_hashes, 100.0*set/(n_words*64),
+           100.0*pow((double) set/(n_words*64), fmi->bloom_hashes));
+  }
   printf("FM-index time: %.3fs\n", wall_1 - wall_0);
   printf("-------------------------------------------------\n\n");
 
+  return 0;
+}
+
+/* releases the memory allocated by generate_SFM */
+static void
+release_SFM(SFM_t *fmi)
+{
+  free(fmi->start);
+  free(fmi->C);
+  free(fmi->entries);
+  free(fmi->encoding_table);
+  free(fmi->encoding_table2);
+  free(fmi->LUT[0]);
+  free(fmi->LUT[1]);
+  free(fmi->sa_marks);
+  free(fmi->sa);
+  free(fmi->isa);
+  free(fmi->packed);
+  free(fmi->bloom);
+}
+
+/* splits data into overlapping shards, and writes their fm-indexes and the
+ * manifest. Occurrences inside the overlap of two consecutive shards are
+ * counted twice, so the overlaps are also indexed to subtract them */
+static int
+build_shards(const char *ref_file, char *data, uint nshards, uint64_t overlap,
+             const build_opts_t *opts)
+{
+  char outfile[PATH_MAX], manifest[PATH_MAX];
+  uint64_t data_len = strlen(data);
+  uint64_t shard_len = ceil_uint_div(data_len, nshards);
+  SFM_t fmi;
+  FILE *f;
+
+  if (overlap >= shard_len)
+  {
+    fprintf(stderr, "Error: shard overlap (%lu) must be shorter than the shards (%lu)\n", overlap, shard_len);
+    return -1;
+  }
+
+  snprintf(manifest, sizeof(manifest), "%s.k%dd%dbv.shards", ref_file, KSTEPS, D_VAL);
+  f = fopen(manifest, "w");
+  if (f == NULL)
+  {
+    fprintf(stderr, "Cannot open file %s \n", manifest);
+    return -1;
+  }
+  fprintf(f, "# bvSFM shards manifest: sign fm-index first_position end_position\n");
+  fprintf(f, "overlap %lu\n", overlap);
+
+  for (uint k = 0; k < nshards; k++)
+  {
+    uint64_t begin = k*shard_len;
+    uint64_t end = begin + shard_len + overlap;
+    if (begin >= data_len) break;
+    if (end > data_len) end = data_len;
+
+    printf("-------------------------------------------------\n");
+    printf("Shard %u: [%lu, %lu)\n", k, begin, end);
+    memset(&fmi, 0, sizeof(fmi));
+    snprintf(outfile, sizeof(outfile), "%s.shard%u.k%dd%dbv.fmi", ref_file, k, KSTEPS, D_VAL);
+    if (build_SFM(strndup(data + begin, end - begin), &fmi, opts, outfile) < 0) return -1;
+    release_SFM(&fmi);
+    fprintf(f, "+1 %s %lu %lu\n", basename(outfile), begin, end);
+
+    // overlap with the next shard
+    if (begin + shard_len < end)
+    {
+      begin += shard_len;
+      printf("Overlap %u: [%lu, %lu)\n", k, begin, end);
+      memset(&fmi, 0, sizeof(fmi));
+      snprintf(outfile, sizeof(outfile), "%s.overlap%u.k%dd%dbv.fmi", ref_file, k, KSTEPS, D_VAL);
+      if (build_SFM(strndup(data + begin, end - begin), &fmi, opts, outfile) < 0) return -1;
+      release_SFM(&fmi);
+      fprintf(f, "-1 %s %lu %lu\n", basename(outfile), begin, end);
+    }
+  }
+
+  fclose(f);
+  free(data);
+  printf("Shards manifest written to file %s\n", manifest);
+  return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+  char * data;
+  uint64_t data_len;
+  char outfile[PATH_MAX];
+  SFM_t fmi;
+  double wall_0, wall_1;
+  int n;
+  int option = 0;
+  build_opts_t opts = { 0, 0, 0, 0, 0, 0 };
+  uint nshards = 1;
+  uint64_t overlap = 1000;
+  const char *ref_file;
+
+  memset(&fmi, 0, sizeof(fmi));
+
+  while(1)
+  {
+      option = getopt_long(argc, argv, optString, longOpts, NULL);
+      if (option == -1) break;
+
+      switch(option)
+      {
+          case 's':
+              n = sscanf(optarg, "%u", &opts.sa_rate);
+              if ((n != 1) || (opts.sa_rate < KSTEPS) || (opts.sa_rate % KSTEPS != 0))
+              {
+                  fprintf(stderr, "ERROR: SA sampling rate must be a multiple of %d\n", KSTEPS);
+                  exit(1);
+              }
+              break;
+
+          case 'i':
+              n = sscanf(optarg, "%u", &opts.isa_rate);
+              if ((n != 1) || (opts.isa_rate < KSTEPS) || (opts.isa_rate % KSTEPS != 0))
+              {
+                  fprintf(stderr, "ERROR: ISA sampling rate must be a multiple of %d\n", KSTEPS);
+                  exit(1);
+              }
+              break;
+
+          case 'p':
+              opts.packed = 1;
+              break;
+
+          case 'b':
+              opts.bloom_bits = BLOOM_BITS;
+              n = sscanf(optarg, "%u:%u", &opts.bloom_k, &opts.bloom_bits);
+              if ((n < 1) || (opts.bloom_k < 1) || (opts.bloom_k > 32) || (opts.bloom_bits < 1))
+              {
+                  fprintf(stderr, "ERROR: wrong k-mer length (up to 32) or bits of the Bloom filter\n");
+                  exit(1);
+              }
+              break;
+
+          case 'S':
+              n = sscanf(optarg, "%u", &nshards);
+              if ((n != 1) || (nshards < 1))
+              {
+                  fprintf(stderr, "ERROR: wrong number of shards\n");
+                  exit(1);
+              }
+              break;
+
+          case 'l':
+              n = sscanf(optarg, "%lu", &overlap);
+              if ((n != 1) || (overlap < 1))
+              {
+                  fprintf(stderr, "ERROR: wrong shard overlap\n");
+                  exit(1);
+              }
+              break;
+
+          case 'v':
+              opts.verbose = 1;
+              break;
+
+          case 'h':
+              show_usage(argv[0], 0);
+              break;
+
+          default:
+              show_usage(argv[0], 1);
+      }
+  }
+
+  if (optind >= argc)
+      show_usage(argv[0], 1);
+  ref_file = argv[optind];
+  // legacy use: ./k2d64bv_build file verbose
+  if (optind + 1 < argc)
+    opts.verbose = 1;
+
+  printf("Reading FM-index file %s... ", ref_file);
+  wall_0 = get_wall_time();
+  n = file_to_char(ref_file, &data);
+  if (n < 0) exit(1);
+  if (data[0] == '>')
+  {
+    // collection of sequences: headers are the separators
+    n = fasta_to_collection(data, &fmi.seq_bounds, &fmi.seq_names);
+    if (n < 0) exit(1);
+    fmi.n_seqs = n;
+    if (opts.sa_rate == 0)
+      opts.sa_rate = SA_SAMPLING_RATE;
+  }
+  data_len = strlen(data);
+  wall_1 = get_wall_time();
+  printf("OK\n");
+  if (fmi.n_seqs > 0)
+    printf("Collection of %u sequences\n", fmi.n_seqs);
+  printf("Total time: %.3fs\n", wall_1 - wall_0);
+  if (opts.verbose)
+  {
+      printf("Reference text");
+      dump_array(data, data_len);
+  }
+  /*--------------------------------------------------------------------------*/
+
+  // init_C(C);
+  // build_C(&C[0][0], data, data_len);
+  // printf("---C Array---(%lu elements)\n", data_len);
+  // dump_C(C);
+  /*--------------------------------------------------------------------------*/
+
+  if (nshards > 1)
+  {
+    if (fmi.n_seqs > 0)
+    {
+      fprintf(stderr, "ERROR: collections cannot be split into shards\n");
+      exit(1);
+    }
+    if (build_shards(ref_file, data, nshards, overlap, &opts) < 0) exit(1);
+    exit(0);
+  }
+
+  snprintf(outfile, sizeof(outfile), "%s.k%dd%dbv.fmi", ref_file, KSTEPS, D_VAL);
+  if (build_SFM(data, &fmi, &opts, outfile) < 0) exit(1);
+
   /*--------------------------------------------------------------------------*/
 
   exit(0);
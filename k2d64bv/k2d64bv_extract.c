@@ -0,0 +1,395 @@
+/*
+ * Copyright 2019, José-Manuel Herruzo <jmherruzo@uma.es>,
+ *                 Jesús Alastruey-Benedé <jalastru@unizar.es>,
+ *                 Pablo Ibáñez-Marín <imarin@unizar.es>
+ *
+ * This file is part of the bvSFM sequence alignment package.
+ *
+ * bvSFM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bvSFM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bvSFM. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * If you publish any work that uses this software, please cite the following paper:
+ *
+ * J.M. Herruzo, S. González-Navarro, P. Ibáñez, V. Viñals, J. Alastruey-Benedé, and Óscar Plata.
+ * Accelerating Sequence Alignments Based on FM-Index Using the Intel KNL Processor.
+ * IEEE/ACM Transactions on Computational Biology and Bioinformatics (TCBB 2019).
+ * DOI: 10.1109/TCBB.2018.2884701 
+ * 
+ * @article{herruzo2019TCBB,
+ *  author    = {José Manuel Herruzo, Sonia González-Navarro, Pablo Ibáñez, Víctor Viñals, Jesús Alastruey-Benedé, and Óscar Plata},
+ *  journal = {IEEE/ACM Transactions on Computational Biology and Bioinformatics (TCBB 2019)},
+ *  title     = {Accelerating Sequence Alignments Based on FM-Index Using the Intel KNL Processor},
+ *  year      = {2019},
+ *  doi       = {10.1109/TCBB.2018.2884701}
+ * }
+ *
+ */
+
+/*
+ * Substrings of the reference decoded from the fm-index.
+ *
+ * Each request is a text position and a length (or a sequence name, an
+ * offset inside that sequence and a length, for collections). A substring
+ * is decoded backwards, two characters per LF step, from the closest
+ * inverse suffix array sample after it (k2d64bv_build -i), so it takes at
+ * most rate/2 + len/2 LF steps. The walks of several substrings are
+ * interleaved (see extract_SFM).
+ */
+
+#include <stdio.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+
+#include "../aux.h"
+#include "../file_mng.h"
+#include "k2d64bv.h"
+
+#ifndef THREADS
+    #ifdef KNL
+        #define THREADS 256
+    #else
+        #define THREADS 28
+    #endif
+#endif
+
+// substrings decoded per batch
+#define EXTRACT_BATCH 4096
+
+////////////////////////////////////////////////////////////////////////////////
+// Module variables
+////////////////////////////////////////////////////////////////////////////////
+
+static SFM_t fmi;
+static uint32_t nthreads = THREADS;
+
+// input options
+static const char *optString = "f:q:t:o:h?";
+static const struct option longOpts[] =
+{
+    {"fmindex",   required_argument,  NULL,   'f'},
+    {"requests",  required_argument,  NULL,   'q'},
+    {"nthreads",  required_argument,  NULL,   't'},
+    {"output",    required_argument,  NULL,   'o'},
+    {"help",      no_argument,        NULL,   'h'},
+    {NULL,                  0,        NULL,    0 }
+};
+/*----------------------------------------------------------------------------*/
+
+static struct option_help {
+    const char *long_opt, *short_opt, *desc;
+} opts_help[] = {
+    { "--fmindex", "-f",
+      "file storing the fm-index (built with inverse suffix array samples)" },
+    { "--requests", "-q",
+      "file with one request per line: position length, or name offset length" },
+    { "--nthreads", "-t",
+      "number of threads" },
+    { "--output", "-o",
+      "file to write the substrings" },
+    { "--help", "-h",
+      "show program usage"},
+    { NULL, NULL, NULL }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Auxiliary functions
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+show_usage(char *name, int exit_code)
+{
+    struct option_help *h;
+
+    printf("usage: %s options\n", name);
+    for (h = opts_help; h->long_opt; h++)
+    {
+        printf(" %s, %s\n ", h->short_opt, h->long_opt);
+        printf("    %s\n", h->desc);
+    }
+    exit(exit_code);
+}
+/*----------------------------------------------------------------------------*/
+
+// text position of the substring of l characters at offset of a sequence of
+// the collection, or -1 if the sequence is not found or the substring does
+// not fit in it
+static int64_t
+seq_position(const char *name, uint64_t offset, uint l)
+{
+  for (uint32_t i = 0; i < fmi.n_seqs; i++)
+  {
+    if (strcmp(fmi.seq_names[i], name) == 0)
+    {
+      uint64_t seq_len = fmi.seq_bounds[i+1] - fmi.seq_bounds[i];
+      return ((offset <= seq_len) && (l <= seq_len - offset)) ? (int64_t)(fmi.seq_bounds[i] + offset) : -1;
+    }
+  }
+  return -1;
+}
+
+// reads the requests: returns the number of requests
+static uint
+load_requests(const char *file, uint64_t **pos, uint **len, char ***labels)
+{
+  char *linep = NULL, name[256];
+  size_t line_size = 0;
+  uint count = 0, size = 0;
+  uint64_t p, offset;
+  uint l;
+  FILE *fp;
+
+  fp = fopen(file, "r");
+  if (fp == NULL)
+  {
+    printf("Error opening file %s\n", file);
+    exit(EXIT_FAILURE);
+  }
+
+  *pos = NULL;
+  *len = NULL;
+  *labels = NULL;
+  while (getline(&linep, &line_size, fp) != -1)
+  {
+    if ((linep[0] == '#') || (linep[0] == '\n')) continue;
+    if (sscanf(linep, "%255s %lu %u", name, &offset, &l) == 3)
+    {
+      int64_t q = seq_position(name, offset, l);
+      if (q < 0)
+      {
+        printf("Error: unknown sequence or request exceeds it: %s", linep);
+        exit(EXIT_FAILURE);
+      }
+      p = q;
+    }
+    else if (sscanf(linep, "%lu %u", &p, &l) != 2)
+    {
+      printf("Error parsing request %s", linep);
+      exit(EXIT_FAILURE);
+    }
+    // compared without overflow (a negative value is read as a huge one)
+    if ((p > fmi.len - 1) || (l > fmi.len - 1 - p))
+    {
+      printf("Error: request exceeds the text (%lu characters): %s", fmi.len - 1, linep);
+      exit(EXIT_FAILURE);
+    }
+
+    if (count == size)
+    {
+      size += 1000;
+      *pos = realloc(*pos, size*sizeof(uint64_t));
+      *len = realloc(*len, size*sizeof(uint));
+      *labels = realloc(*labels, size*sizeof(char*));
+      if ((*pos == NULL) || (*len == NULL) || (*labels == NULL))
+      {
+        printf("Error at malloc\n");
+        exit(EXIT_FAILURE);
+      }
+    }
+    linep[strcspn(linep, "\r\n")] = 0;
+    (*pos)[count] = p;
+    (*len)[count] = l;
+    (*labels)[count] = strdup(linep);
+    count++;
+  }
+  fclose(fp);
+  free(linep);
+  return count;
+}
+
+// decodes the substrings and writes them in request order
+static uint64_t
+extract(const uint64_t *pos, const uint *len, char **labels, uint count, FILE *fp)
+{
+  uint64_t decoded = 0;
+  char **buffers;
+  size_t *buffers_len;
+
+  omp_set_num_threads(nthreads);
+  buffers = calloc(nthreads, sizeof(char*));
+  buffers_len = calloc(nthreads, sizeof(size_t));
+  if ((buffers == NULL) || (buffers_len == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+
+  #pragma omp parallel reduction(+:decoded)
+  {
+    char *out[EXTRACT_BATCH];
+    uint thread_id = omp_get_thread_num();
+    uint th_threads = omp_get_num_threads();
+    FILE *th_out = open_memstream(&buffers[thread_id], &buffers_len[thread_id]);
+
+    // contiguous blocks of requests keep the output in request order
+    uint bl_begin = (uint)((uint64_t) count*thread_id/th_threads);
+    uint bl_end   = (uint)((uint64_t) count*(thread_id + 1)/th_threads);
+
+    for (uint i = bl_begin; i < bl_end; i += EXTRACT_BATCH)
+    {
+      uint n = (bl_end - i < EXTRACT_BATCH) ? bl_end - i : EXTRACT_BATCH;
+
+      for (uint k = 0; k < n; k++)
+      {
+        out[k] = malloc(len[i+k] + 1);
+        if (out[k] == NULL)
+        {
+          printf("Error at malloc\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      extract_SFM(&fmi, pos + i, len + i, out, n);
+      for (uint k = 0; k < n; k++)
+      {
+        fprintf(th_out, "%s\t%s\n", labels[i+k], out[k]);
+        decoded += len[i+k];
+        free(out[k]);
+      }
+    }
+    fclose(th_out);
+  }
+
+  for (uint t = 0; t < nthreads; t++)
+  {
+    if (buffers[t] == NULL) continue;
+    fwrite(buffers[t], sizeof(char), buffers_len[t], fp);
+    free(buffers[t]);
+  }
+  free(buffers);
+  free(buffers_len);
+  return decoded;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main function
+////////////////////////////////////////////////////////////////////////////////
+
+int
+main(int argc, char *argv[])
+{
+  char *fmi_file = 0;
+  char *req_file = 0;
+  char *out_file = 0;
+  uint64_t *pos, decoded;
+  uint *len, count;
+  char **labels;
+  double start_timer, end_timer;
+  int n = 0, option = 0;
+  FILE *fp;
+
+  while(1)
+  {
+      option = getopt_long(argc, argv, optString, longOpts, NULL /* &longIndex */);
+      if (option == -1) break;
+
+      switch(option)
+      {
+          case 'f':
+              fmi_file = optarg;
+              break;
+
+          case 'q':
+              req_file = optarg;
+              break;
+
+          case 't':
+              n = sscanf(optarg, "%u", &nthreads);
+              if ((n != 1) || (nthreads < 1))
+              {
+                  printf("ERROR: wrong number of threads\n\n");
+                  exit(1);
+              }
+              break;
+
+          case 'o':
+              out_file = optarg;
+              break;
+
+          case 'h':
+              show_usage(argv[0], 0);
+              break;
+
+          default:
+              show_usage(argv[0], 1);
+      }
+  }
+
+  /* check arguments */
+  if (fmi_file == 0)
+  {
+      printf("ERROR: fm-index file not specified\n");
+      show_usage(argv[0], 1);
+  }
+  if (req_file == 0)
+  {
+      printf("ERROR: requests file not specified\n");
+      show_usage(argv[0], 1);
+  }
+  if (out_file == 0)
+  {
+      printf("ERROR: output file not specified\n");
+      show_usage(argv[0], 1);
+  }
+
+  printf("Loading FM-index...\n");
+  start_timer = omp_get_wtime();
+  if (load_SFM(fmi_file, &fmi) < 0) exit(EXIT_FAILURE);
+  end_timer = omp_get_wtime();
+  printf("OK. Index loaded in %fs\n", end_timer - start_timer);
+  if (fmi.isa_rate == 0)
+  {
+      printf("ERROR: fm-index does not store inverse suffix array samples (k2d64bv_build -i)\n");
+      exit(EXIT_FAILURE);
+  }
+  printf(HLINE);
+
+  count = load_requests(req_file, &pos, &len, &labels);
+
+  printf("Parameters\n");
+  printf("- FM-index file: %s\n", fmi_file);
+  printf("- Index size: %.1fGiB (%lu characters)\n", (double)(fmi.len)/GiB, fmi.len);
+  printf("- ISA sampling rate: %u\n", fmi.isa_rate);
+  printf("- Number of threads: %d\n", nthreads);
+  printf("- Requests file: %s\n", req_file);
+  printf("- Number of requests: %u\n", count);
+  printf(HLINE);
+
+  fp = fopen(out_file, "w");
+  if (fp == NULL)
+  {
+    printf("Error opening file %s\n", out_file);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Extracting substrings... \n");
+  start_timer = omp_get_wtime();
+  decoded = extract(pos, len, labels, count, fp);
+  end_timer = omp_get_wtime();
+  fclose(fp);
+  printf("OK\n");
+  printf("Characters decoded: %.2fM\n", decoded/MEGA);
+  printf("Total time: %f\n", end_timer - start_timer);
+  printf("Throughput: %.3f Mrequests/s, %.3f MB/s\n", count/(MEGA*(end_timer - start_timer)),
+         decoded/(MEGA*(end_timer - start_timer)));
+  printf("Substrings written to file %s\n", out_file);
+  printf(HLINE);
+
+  for (uint i = 0; i < count; i++)
+    free(labels[i]);
+  free(labels);
+  free(pos);
+  free(len);
+  free_SFM(&fmi);
+  return 0;
+}
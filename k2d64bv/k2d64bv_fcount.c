@@ -35,17 +35,25 @@
  *
  */
  
-// sched_getcpu()
-// #define _GNU_SOURCE
+// sched_getcpu(), pthread_setaffinity_np()
+#define _GNU_SOURCE
 
 #include <stdio.h>
+#include <limits.h>
+#include <libgen.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
 #include <omp.h>
 #include <time.h>
 #include <stdlib.h>
 #include <math.h>
 #include <xmmintrin.h>
+#include <immintrin.h>
 #include <float.h>
-//#include <sched.h>  // sched_getcpu()
+#include <sched.h>
+#include <pthread.h>
 #include <sys/syscall.h>
 #include <unistd.h>
 #include <getopt.h>
@@ -75,8 +83,48 @@
     #define NSEQS     4
 #endif
 
+// overlapped sequences per physical core (-n core): about as many misses in
+// flight as the miss buffers of a core can hold
+#ifndef CORE_SEQS
+    #ifdef KNL
+        #define CORE_SEQS 16
+    #else
+        #define CORE_SEQS 20
+    #endif
+#endif
+#define _STR(x) #x
+#define STR(x)  _STR(x)
+#define CORE_SEQS_STR STR(CORE_SEQS)
+
 #define BYTES_PER_CACHE_BLOCK 64
 
+// rows located per batch when counting occurrences per sequence
+#define LOCATE_BATCH 4096
+
+// sequences per chunk handed out to the threads (dynamic load balancing)
+#define CHUNK_SEQS 256
+
+// chunks in flight in the queue of the thread pool (power of two)
+#define POOL_RING 4096
+
+// breadth-first engine: reads per segment of a thread (-e bfs:n), bits of the
+// digits of the radix sort of the LF lookups and prefetch distance of the sweep
+#define BFS_SEQS 65536
+#define BFS_RADIX_BITS 11
+#define BFS_PREFETCH 16
+
+// hot k-mer cache: characters of the cached suffixes (-C MB:depth) and range
+// (2 bits per symbol and a marker bit in the 64-bit key)
+#define CACHE_DEPTH 12
+#define CACHE_MIN_DEPTH 8
+#define CACHE_MAX_DEPTH 31
+
+// streaming mode: sequences per batch with -s - (stdin), batches in the ring
+// (parsed, searched, written) and initial size of the input buffer
+#define STREAM_SEQS 262144
+#define STREAM_SLOTS 3
+#define STREAM_BUFFER (4UL << 20)
+
    
 /*  The program runs the kernel nruns times (default 5) and 
  *  reports the *best* result for any iteration after the first,
@@ -100,18 +148,216 @@
 // Module variables
 ////////////////////////////////////////////////////////////////////////////////
 
+// BWT interval of the occurrences of a sequence [start, end)
+typedef struct interval {
+  uint64_t start;
+  uint64_t end;
+} interval_t;
+
+// sequences searched together: the results of a sequence are added to its batch
+typedef struct batch {
+  char **lines;
+  uint *lines_len;
+  uint64_t *offsets;      // packed sequences: first byte of each one in read_store
+  uint count;
+  interval_t *intervals;  // per-read intervals (NULL if not requested)
+  uint64_t total;         // occurrences found
+  uint pending;           // sequences not finished yet
+} batch_t;
+
+// sequences [begin, end) of a batch, the unit of work taken by a thread
+typedef struct chunk {
+  batch_t *batch;
+  uint begin, end;
+} chunk_t;
+
+// source of chunks of the kernels: returns 0 if there are none (yet)
+typedef int (*chunk_fn)(chunk_t *chunk);
+
+// counters of a thread, in its own cache block
+typedef struct thread_stats {
+  uint64_t lf, unique, saved;
+  uint64_t empty, skipped;  // sequences retired on an empty interval, LF steps skipped
+  uint64_t shared;          // LF steps taken from the previous read (-e trie)
+  uint64_t probes, hits, cached;  // hot k-mer cache: lookups, hits, LF steps saved
+  uint64_t filtered, fsaved, zeros; // Bloom prefilter: rejected, LF steps saved; no occurrences
+  double start, end;      // time of the search loop (team)
+  int taken;              // static split: block of the thread already taken
+  uint *tokens;           // free slots of its core (-S), NULL: not shared
+} __attribute__ ((aligned(BYTES_PER_CACHE_BLOCK))) thread_stats_t;
+
+// fm-index of a segment of the reference (see k2d64bv_build -S)
+typedef struct shard {
+  int sign;             // +1: shard, -1: overlap of two consecutive shards
+  uint worker;          // process that searches it
+  char file[PATH_MAX];
+  uint64_t begin, end;  // segment of the reference [begin, end)
+} shard_t;
+
+// results of a worker process (shard or rank)
+typedef struct worker_stats {
+  int node;             // NUMA node (-1: not bound)
+  uint count;           // sequences searched
+  double time;
+  uint64_t lf;
+  int64_t total;
+} worker_stats_t;
+
 static SFM_t fmi;
 static uint64_t mask_64b[64];
 static uint32_t nthreads = THREADS;
 
+// per-read intervals (NULL if per-read results are not requested)
+static interval_t *intervals = NULL;
+
+// sequences encoded once after loading (pack_reads()): 2 bits per symbol, each
+// sequence reversed and packed from the LSBs, so that the k2 symbol of the
+// characters [i, i+1] is the nibble at bit 2*(len - 2 - i); read_offsets: first
+// byte of each sequence. idle_read: symbols of the idle slots
+static uint8_t *read_store = NULL;
+static uint64_t *read_offsets = NULL, read_store_bytes = 0;
+static uint8_t idle_read[8] = { 0 };
+
+// text of the loaded sequences (load_sequences()): one arena per part of the
+// file, filled by the thread that parses it; lines[i] points into them
+static read_arena_t *arenas = NULL;
+static uint narenas = 0;
+
+// duplicate reads collapsed before the search (-D): the distinct sequences are
+// searched and their results are fanned out to the reads
+static struct {
+  int enabled;
+  uint count;           // distinct sequences
+  char **lines;         // first copy of each distinct sequence
+  uint *lines_len;
+  uint *read;           // distinct sequence of each read
+  uint *copies;         // reads of each distinct sequence
+  uint64_t bases;       // bases of the distinct sequences
+} dedup = { 0 };
+
+// unique-interval shortcut: minimum number of characters left (0: disabled)
+static int unique_mode = 0;
+static uint unique_min = 0;
+// reads resolved by the shortcut and LF steps saved in the last search
+static uint64_t unique_reads = 0, unique_saved = 0;
+// reads retired on an empty interval and LF steps skipped in the last search
+static uint64_t empty_reads = 0, empty_skipped = 0;
+// LF steps shared by reads with a common suffix in the last search (-e trie)
+static uint64_t trie_shared = 0;
+
+// entry of the hot k-mer cache: BWT interval of a suffix
+typedef struct cache_entry {
+  uint64_t key;         // packed suffix (CACHE_EMPTY, CACHE_BUSY: being written)
+  uint64_t start, end;
+} cache_entry_t;
+
+#define CACHE_EMPTY 0
+#define CACHE_BUSY  1
+
+// hot k-mer cache (-C): intervals of the suffixes of depth characters (depth-1
+// for the reads of the other parity), shared by the threads, direct mapped and
+// lock-free; NULL entries: disabled
+static struct {
+  cache_entry_t *entries;
+  uint64_t size;        // entries (memory budget / entry)
+  uint depth;
+} hot_cache = { NULL, 0, CACHE_DEPTH };
+// lookups, hits and LF steps saved by the cache in the last search
+static uint64_t cache_probes = 0, cache_hits = 0, cache_saved = 0;
+static double cache_mib = 0.0;
+
+// Bloom prefilter (-F): k-mers tested per read (0: disabled); reads rejected,
+// LF steps saved and reads without occurrences in the last search
+static uint bloom_kmers = 0;
+static uint64_t filter_reads = 0, filter_saved = 0, filter_zeros = 0;
+
+// sequences per chunk taken by a thread from the shared cursor (0: static split)
+static uint chunk_size = CHUNK_SEQS;
+static uint chunk_cursor = 0;
+// sequences per batch submitted to the search (0: a single batch)
+static uint batch_size = 0;
+// counters of each thread in the last search
+static thread_stats_t *thread_stats = NULL;
+
+// placement policy of the threads (-B, -1: not bound) and cpu of each thread
+static int bind_policy = -1;
+static int *bind_cpus = NULL;
+static const char *bind_names[] = { "compact", "scatter", "socket", "smt", NULL };
+
+// overlapped sequences per physical core (-n core, 0: a single kernel), kernel
+// of each thread and free slots of each core (-S)
+static uint core_seqs = 0;
+static int share_slots = 0;
+static const struct kernel **thread_kernels = NULL;
+static struct core_slots *core_slots = NULL;
+
+// breadth-first engine (-e bfs, -e trie: walk of the suffix trie) and reads
+// per segment of a thread
+static int engine_bfs = 0, engine_trie = 0;
+static uint bfs_seqs = BFS_SEQS;
+
+// persistent worker threads (--pool), fed through a lock-free ring of chunks
+// with a single producer (the main thread) and many consumers (the workers)
+static struct {
+  int enabled;
+  pthread_t *threads;
+  chunk_t ring[POOL_RING];
+  uint head __attribute__ ((aligned(BYTES_PER_CACHE_BLOCK)));  // next chunk to take
+  uint tail __attribute__ ((aligned(BYTES_PER_CACHE_BLOCK)));  // next free entry
+  int stop;
+} pool;
+
+// streaming mode (-q n): a parser thread fills a ring of batches of n
+// sequences, the main thread searches them and an output thread writes their
+// results; batch k uses the slot k % STREAM_SLOTS, and the counters of the
+// stages (parsed >= searched >= written) tell which slots are free
+typedef struct stream_batch {
+  read_arena_t arena;           // text of the sequences (mapping reused)
+  char **lines;
+  interval_t *intervals;
+  uint64_t first;               // index of the first sequence
+  uint count;                   // sequences
+} stream_batch_t;
+
+static uint stream_seqs = 0;
+static struct {
+  stream_batch_t ring[STREAM_SLOTS];
+  pthread_mutex_t lock;
+  pthread_cond_t changed;
+  uint parsed, searched, written;
+  int done;                     // end of input: parsed is final
+  seq_stream_t input;
+  FILE *out;
+  uint64_t reads, bases, bytes;
+  double parse_time, output_time;
+} stream = { .lock = PTHREAD_MUTEX_INITIALIZER, .changed = PTHREAD_COND_INITIALIZER };
+
 // input options
-static const char *optString = "f:s:t:r:h?";
+static const char *optString = "f:m:p:s:t:r:o:k:n:i:c:b:PB:Se:C:F:q:dDuh?";
 static const struct option longOpts[] =
 {
     {"fmindex",   required_argument,  NULL,   'f'},
+    {"manifest",  required_argument,  NULL,   'm'},
+    {"ranks",     required_argument,  NULL,   'p'},
     {"sequences", required_argument,  NULL,   's'},
     {"nthreads",  required_argument,  NULL,   't'},
     {"runs",      required_argument,  NULL,   'r'},
+    {"output",    required_argument,  NULL,   'o'},
+    {"kernel",    required_argument,  NULL,   'k'},
+    {"nseqs",     required_argument,  NULL,   'n'},
+    {"isa",       required_argument,  NULL,   'i'},
+    {"chunk",     required_argument,  NULL,   'c'},
+    {"batch",     required_argument,  NULL,   'b'},
+    {"pool",      no_argument,        NULL,   'P'},
+    {"bind",      required_argument,  NULL,   'B'},
+    {"share-slots", no_argument,      NULL,   'S'},
+    {"engine",    required_argument,  NULL,   'e'},
+    {"cache",     required_argument,  NULL,   'C'},
+    {"filter",    required_argument,  NULL,   'F'},
+    {"stream",    required_argument,  NULL,   'q'},
+    {"docs",      no_argument,        NULL,   'd'},
+    {"dedup",     no_argument,        NULL,   'D'},
+    {"unique",    no_argument,        NULL,   'u'},
     {"help",      no_argument,        NULL,   'h'},
     {NULL,                  0,        NULL,    0 }
 };
@@ -122,12 +368,57 @@ static struct option_help {
 } opts_help[] = {
     { "--fmindex", "-f",
       "file storing the fm-index" },
+    { "--manifest", "-m",
+      "shards manifest: one worker process per shard instead of -f" },
+    { "--ranks", "-p",
+      "number of processes, each one searching a part of the sequence file" },
     { "--sequences", "-s",
-      "file storing the sequences to search" },
+      "FASTA or FASTQ file storing the sequences to search (plain, gzip or BGZF, - for\n"
+      "     standard input)" },
     { "--nthreads", "-t",
       "number of threads" },
     { "--runs", "-r",
       "number of runs" },
+    { "--output", "-o",
+      "file to write per-read occurrences" },
+    { "--kernel", "-k",
+      "search kernel: scalar (default) or vector (AVX2 or AVX-512 hosts)" },
+    { "--nseqs", "-n",
+      "overlapped sequences: 2, 4, 6, 8, 12, 16, 20, 24, 32 or 40 (sp/dp suffix: prefetch),\n"
+      "     auto to time the kernels on a sample of the sequences, or core[:n] for n per\n"
+      "     physical core, split among the threads that share it (default " CORE_SEQS_STR ")" },
+    { "--isa", "-i",
+      "instruction set of the kernels: avx512, avx2 or base (default: best for this host)" },
+    { "--chunk", "-c",
+      "sequences per chunk handed out to the threads (default 256, 0: static split)" },
+    { "--batch", "-b",
+      "sequences per batch submitted to the search (default 0: a single batch)" },
+    { "--pool", "-P",
+      "persistent pool of pinned threads: batches are queued and overlapped" },
+    { "--bind", "-B",
+      "pin the threads to cpus: compact, scatter, socket (one socket at a time) or smt\n"
+      "     (SMT siblings first)" },
+    { "--share-slots", "-S",
+      "with -n core, the threads of a core take their sequences from a shared budget" },
+    { "--engine", "-e",
+      "interleaved (default: overlapped sequences), bfs[:n] (breadth-first, n sequences\n"
+      "     per thread and round, radix-sorted LF lookups) or trie[:n] (bfs over the trie of\n"
+      "     the suffixes of the sequences, shared suffixes searched once)" },
+    { "--cache", "-C",
+      "cache of the intervals of hot k-mers: MiB[:depth] (depth " STR(CACHE_MIN_DEPTH) " to " STR(CACHE_MAX_DEPTH)
+      ", default " STR(CACHE_DEPTH) " characters)" },
+    { "--filter", "-F",
+      "test n k-mers of each sequence against the Bloom filter of the index (k2d64bv_build\n"
+      "     -b): sequences with an absent k-mer are not searched (no occurrences)" },
+    { "--stream", "-q",
+      "stream the sequences in batches of n: parsing, search and output overlapped in\n"
+      "     constant memory (implied by -s -, standard input, with " STR(STREAM_SEQS) ")" },
+    { "--docs", "-d",
+      "per-read occurrences in each sequence of a collection (requires -o)" },
+    { "--dedup", "-D",
+      "search each distinct sequence once, duplicates take its result" },
+    { "--unique", "-u",
+      "compare with the packed text once the interval is a single row (k2d64bv_build -p)" },
     { "--help", "-h",
       "show program usage"},
     { NULL, NULL, NULL }
@@ -152,230 +443,2228 @@ show_usage(char *name, int exit_code)
 }
 /*----------------------------------------------------------------------------*/
 
-// it really computes k2_LF(idx-1)
-static __forceinline uint64_t
-k2_LF(uint64_t idx, SFM_entry_t *entry)
+// key of the cache for the depth characters of a suffix: 2-bit symbols after
+// a marker bit, so that suffixes of different lengths do not collide
+static inline uint64_t
+cache_key(const char *suffix, uint depth)
+{
+  uint64_t key = 1;
+  for (uint i = 0; i < depth; i++)
+    key = (key << BITS_PER_SYMBOL) | fmi.encoding_table[(uint) suffix[i]];
+  return key;
+}
+
+static inline cache_entry_t *
+cache_slot(uint64_t key)
 {
-    // uint32_t entry_id     = idx / D_VAL;    // SFM entry index
-    uint32_t entry_offset = idx % D_VAL;    // offset en la SFM entry
-    uint64_t count = entry->counter;
-    count += _popcnt64(entry->data & mask_64b[entry_offset]);
-    return count;
+  uint64_t h = key*0x9E3779B97F4A7C15UL;
+  return &hot_cache.entries[(uint64_t)(((unsigned __int128) h*hot_cache.size) >> 64)];
+}
+
+// interval of a suffix, 0 if not cached; the key is read again after the
+// interval (seqlock), and a given key always stores the same interval
+static inline int
+cache_lookup(uint64_t key, uint64_t *start, uint64_t *end)
+{
+  cache_entry_t *e = cache_slot(key);
+  if (__atomic_load_n(&e->key, __ATOMIC_ACQUIRE) != key) return 0;
+  uint64_t s = __atomic_load_n(&e->start, __ATOMIC_RELAXED);
+  uint64_t t = __atomic_load_n(&e->end, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_ACQUIRE);
+  if (__atomic_load_n(&e->key, __ATOMIC_RELAXED) != key) return 0;
+  *start = s;
+  *end = t;
+  return 1;
+}
+
+// stores the interval of a suffix, replacing the entry of the slot (skipped
+// if another thread is writing it)
+static inline void
+cache_store(uint64_t key, uint64_t start, uint64_t end)
+{
+  cache_entry_t *e = cache_slot(key);
+  uint64_t old = __atomic_load_n(&e->key, __ATOMIC_RELAXED);
+  if ((old == key) || (old == CACHE_BUSY) ||
+      !__atomic_compare_exchange_n(&e->key, &old, CACHE_BUSY, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED))
+    return;
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&e->start, start, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->end, end, __ATOMIC_RELAXED);
+  __atomic_store_n(&e->key, key, __ATOMIC_RELEASE);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 // Macros
 ////////////////////////////////////////////////////////////////////////////////
 
-// Check if a sequence has finished the processing
+// takes a free slot of the core of the thread (-S), 1 if not shared
+static inline int
+take_slot(uint *tokens)
+{
+  if (tokens == NULL) return 1;
+  uint free_slots = __atomic_load_n(tokens, __ATOMIC_RELAXED);
+  while (free_slots > 0)
+    if (__atomic_compare_exchange_n(tokens, &free_slots, free_slots - 1, 1,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+      return 1;
+  return 0;
+}
+
+// Assign the next sequence of the current chunk to a slot, taking a new chunk
+// from next_chunk() when it is exhausted; without sequences (or without a free
+// slot of the core, -S) the slot is idle (empty interval on the first
+// characters of the text) and polls again at the next step
+#define _NEXT_SEQ( INDEX )                                                     \
+  if ((next_line == chunk.end) && next_chunk(&chunk))                          \
+    next_line = chunk.begin;                                                   \
+  if ((next_line < chunk.end) && take_slot(tokens))                            \
+  {                                                                            \
+    slot_batch[INDEX] = chunk.batch;                                           \
+    line_index[INDEX] = next_line++;                                           \
+    working_lines[INDEX] = chunk.batch->lines[line_index[INDEX]];              \
+    lengths[INDEX] = chunk.batch->lines_len[line_index[INDEX]];                \
+    packed_lines[INDEX] = read_store + chunk.batch->offsets[line_index[INDEX]];\
+    active++;                                                                  \
+  }                                                                            \
+  else                                                                         \
+    slot_batch[INDEX] = NULL;
+
+// Check if a sequence has finished the processing, or has an empty interval
+// (no occurrences: the rest of its LF steps are skipped); its results go to
+// its batch and the slot is refilled at once (again if the new sequence is
+// empty after the LUT)
 #define _CHECK_FINISHED_SEQ( INDEX )                             \
-  if (index[INDEX] < 0 )                                         \
+  while ((index[INDEX] < 0) ||                                   \
+         ((start[INDEX] >= end[INDEX]) && (slot_batch[INDEX] != NULL))) \
   {                                                              \
-    total += end[INDEX] - start[INDEX];                          \
-    if (finished_seqs + NSEQS >= block_len)                      \
+    batch_t *batch = slot_batch[INDEX];                          \
+    if (batch != NULL)                                           \
     {                                                            \
-      working_lines[INDEX] = lines[count];                       \
-      line_index[INDEX] = count;                                 \
+      if (start[INDEX] >= end[INDEX])                            \
+      {                                                          \
+        /* LF steps left: two per character not processed */     \
+        empty += (index[INDEX] >= 0);                            \
+        skipped += (index[INDEX] >= 0)*2*(index[INDEX] + KSTEPS);\
+        end[INDEX] = start[INDEX];                               \
+      }                                                          \
+      if (batch->intervals != NULL)                              \
+      {                                                          \
+        batch->intervals[line_index[INDEX]].start = start[INDEX];  \
+        batch->intervals[line_index[INDEX]].end   = end[INDEX];    \
+      }                                                          \
+      __atomic_fetch_add(&batch->total, end[INDEX] - start[INDEX], __ATOMIC_RELAXED); \
+      zeros += (end[INDEX] == start[INDEX]);                     \
+      _STORE_STATS();                                            \
+      __atomic_fetch_sub(&batch->pending, 1, __ATOMIC_RELEASE);  \
+      if (tokens != NULL)                                        \
+        __atomic_fetch_add(tokens, 1, __ATOMIC_RELAXED);         \
+      active--;                                                  \
     }                                                            \
-    else                                                         \
+    _NEXT_SEQ(INDEX);                                            \
+    cache_at[INDEX] = INT_MIN;                                   \
+                                                                 \
+    if ((slot_batch[INDEX] != NULL) && bloom_kmers &&            \
+        !bloom_SFM(&fmi, working_lines[INDEX], lengths[INDEX], bloom_kmers)) \
     {                                                            \
-      working_lines[INDEX] = lines_block[finished_seqs + NSEQS]; \
-      line_index[INDEX] = bl_offset + finished_seqs + NSEQS;     \
+      /* a k-mer is not in the reference: no occurrences */      \
+      filtered++;                                                \
+      fsaved += 2*lengths[INDEX];                                \
+      start[INDEX] = end[INDEX] = 0;                             \
+      index[INDEX] = -KSTEPS;                                    \
     }                                                            \
-    lengths[INDEX] = lines_len[line_index[INDEX]];               \
-    finished_seqs++;                                             \
-                                                                 \
-    uint lut_index = 0, shift_bits = 0;                          \
-    uint lut_index_len = 6 - (lengths[INDEX] % 2);               \
-    for (uint i=lengths[INDEX] - 1; i > lengths[INDEX] - 1 - lut_index_len; i--)             \
-    {                                                                                        \
-      lut_index += (uint)(fmi.encoding_table[(uint)working_lines[INDEX][i]]) << shift_bits;  \
-      shift_bits += BITS_PER_SYMBOL;                             \
+    else if (slot_batch[INDEX] != NULL)                          \
+    {                                                            \
+      /* the last characters are the first symbols of the packed sequence */ \
+      uint lut_index_len = 6 - (lengths[INDEX] % 2);             \
+      uint lut_index = *((uint16_t*) packed_lines[INDEX]) &      \
+                       ((1U << (BITS_PER_SYMBOL*lut_index_len)) - 1); \
+      packed_base[INDEX] = (uint64_t)(uintptr_t) packed_lines[INDEX]*8 + \
+                           BITS_PER_SYMBOL*(lengths[INDEX] - KSTEPS);    \
+      lf += lut_index_len*2;                                     \
+      start[INDEX] = fmi.LUT[lengths[INDEX] % KSTEPS][lut_index].start;     \
+      end[INDEX]   = fmi.LUT[lengths[INDEX] % KSTEPS][lut_index].end + 1;   \
+      index[INDEX] = (int)(lengths[INDEX] - KSTEPS - lut_index_len);        \
+      if (hot_cache.entries != NULL)                                        \
+        _CACHE_PROBE(INDEX, lut_index_len);                                 \
+      /* printf("\nseq %u: %s\n", line_index[INDEX], working_lines[INDEX]); */ \
+      /* decode_symbols(lut_index, seq_tmp, fmi.alphabet, BITS_PER_SYMBOL, lut_index_len); */ \
+      /* printf("  LUT_index = %u = %s\n", lut_index, seq_tmp); */           \
+    }                                                            \
+    else                                                         \
+    {                                                            \
+      working_lines[INDEX] = fmi.start;                          \
+      packed_base[INDEX] = (uint64_t)(uintptr_t) idle_read*8;    \
+      start[INDEX] = end[INDEX] = 0;                             \
+      index[INDEX] = 0;                                          \
     }                                                            \
-    lf += lut_index_len*2;                                             \
-    start[INDEX] = fmi.LUT[lengths[INDEX] % KSTEPS][lut_index].start;       \
-    end[INDEX]   = fmi.LUT[lengths[INDEX] % KSTEPS][lut_index].end + 1;     \
-    index[INDEX] = lengths[INDEX] - KSTEPS - lut_index_len;                 \
-    /* printf("\nseq %u: %s\n", line_index[INDEX], working_lines[INDEX]); */ \
-    /* decode_symbols(lut_index, seq_tmp, fmi.alphabet, BITS_PER_SYMBOL, lut_index_len); */ \
-    /* printf("  LUT_index = %u = %s\n", lut_index, seq_tmp); */             \
   }
 
+// Look up the suffix of the cached depth of a new sequence (-C): on a hit it
+// takes the interval and skips the steps up to that depth, otherwise the
+// interval is stored when the sequence gets there (index == cache_at)
+#define _CACHE_PROBE( INDEX, LUT_LEN )                                         \
+  {                                                                            \
+    uint depth = hot_cache.depth - ((hot_cache.depth + lengths[INDEX]) % 2);   \
+    if (lengths[INDEX] >= depth)                                               \
+    {                                                                          \
+      uint64_t key = cache_key(working_lines[INDEX] + lengths[INDEX] - depth, depth); \
+      probes++;                                                                \
+      if (cache_lookup(key, &start[INDEX], &end[INDEX]))                       \
+      {                                                                        \
+        hits++;                                                                \
+        cached += 2*(depth - (LUT_LEN));                                       \
+        index[INDEX] -= depth - (LUT_LEN);                                     \
+      }                                                                        \
+      else                                                                     \
+      {                                                                        \
+        cache_keys[INDEX] = key;                                               \
+        cache_at[INDEX] = (int)(lengths[INDEX] - KSTEPS - depth);              \
+      }                                                                        \
+    }                                                                          \
+  }
+
+// Store the interval of a sequence that has just processed the cached depth
+#define _CACHE_STORE( INDEX )                                                  \
+  if (index[INDEX] == cache_at[INDEX])                                         \
+    cache_store(cache_keys[INDEX], start[INDEX], end[INDEX]);
+
+// Publish the counters of the thread (read by pool_search() once the
+// sequences of its batches have finished)
+#define _STORE_STATS()                                                         \
+  __atomic_store_n(&stats->lf, lf, __ATOMIC_RELAXED);                          \
+  __atomic_store_n(&stats->unique, unique, __ATOMIC_RELAXED);                  \
+  __atomic_store_n(&stats->saved, saved, __ATOMIC_RELAXED);                    \
+  __atomic_store_n(&stats->empty, empty, __ATOMIC_RELAXED);                    \
+  __atomic_store_n(&stats->skipped, skipped, __ATOMIC_RELAXED);                  \
+  __atomic_store_n(&stats->probes, probes, __ATOMIC_RELAXED);                    \
+  __atomic_store_n(&stats->hits, hits, __ATOMIC_RELAXED);                        \
+  __atomic_store_n(&stats->cached, cached, __ATOMIC_RELAXED);                    \
+  __atomic_store_n(&stats->filtered, filtered, __ATOMIC_RELAXED);                \
+  __atomic_store_n(&stats->fsaved, fsaved, __ATOMIC_RELAXED);                    \
+  __atomic_store_n(&stats->zeros, zeros, __ATOMIC_RELAXED);
+
+// Unique interval: locate the row and compare the rest of the sequence with
+// the text; the LF steps saved are two per character not processed, less
+// those of the locate walk (one k2 step of a single row: KSTEPS)
+#define _CHECK_UNIQUE_SEQ( INDEX )                                             \
+  if (unique_min && (end[INDEX] - start[INDEX] == 1) &&                        \
+      (index[INDEX] + KSTEPS >= (int) unique_min))                             \
+  {                                                                            \
+    /* working_lines[INDEX][index[INDEX] + KSTEPS ...] matches at pos */       \
+    uint prefix = index[INDEX] + KSTEPS;                                       \
+    uint64_t pos, walk;                                                        \
+    walk = locate_SFM(&fmi, &start[INDEX], &pos, 1)*KSTEPS;                    \
+    if ((pos < prefix) ||                                                      \
+        !compare_SFM(&fmi, pos - prefix, working_lines[INDEX], prefix))        \
+      end[INDEX] = start[INDEX];                                               \
+    lf += walk;                                                                \
+    unique += (slot_batch[INDEX] != NULL);                                     \
+    saved += (slot_batch[INDEX] != NULL)*(2*(uint64_t) prefix - walk);         \
+    index[INDEX] = -KSTEPS;                                                    \
+  }
+
+// k2 symbol of the two chars [index, index + 1] of a packed sequence, whose
+// symbol len - 2 starts at bit base (bit address: byte address x 8)
+#define PACKED_SYMBOL( base, index )                                           \
+  ({ uint64_t bit_ = (base) - BITS_PER_SYMBOL*(uint64_t)(index);               \
+     (*((uint16_t*)(uintptr_t)(bit_ >> 3)) >> (bit_ & 7)) & (K2_SYMBOLS - 1); })
+
 // Encode the two next chars to process
 #define _ENCODE_CHARS( INDEX )                                             \
-  next_symbol[INDEX] = fmi.encoding_table2[                                \
-                  *((uint16_t*)(working_lines[INDEX] + index[INDEX]))];    \
+  next_symbol[INDEX] = PACKED_SYMBOL(packed_base[INDEX], index[INDEX]);    \
   index[INDEX] -= KSTEPS;
 
-static uint64_t __attribute__ ((noinline))
-search(char **lines, uint *lines_len, uint count, uint *found, double *glfops)
+////////////////////////////////////////////////////////////////////////////////
+// Kernels: k2d64bv_isa.h builds a clone of the kernels for each instruction
+// set (#pragma GCC target), and the clone for the host is selected at startup
+////////////////////////////////////////////////////////////////////////////////
+
+#define _KERNEL_CAT(a, b, c, d) a ## b ## c ## d
+#define KERNEL_CAT(a, b, c, d)  _KERNEL_CAT(a, b, c, d)
+
+typedef void (*run_fn)(chunk_fn, int, thread_stats_t *);
+
+// search kernel specialized for a number of overlapped sequences
+typedef struct kernel {
+  uint nseqs;
+  int dual;             // 1: prefetch into L2 and L1, 0: only into L2
+  uint lanes;           // vector kernel (-k vector): lanes per vector, 0: scalar
+  run_fn run;           // runs the kernel in the calling thread
+} kernel_t;
+
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+#pragma GCC push_options
+#pragma GCC target("popcnt")
+#define KERNEL_ISA _base
+#include "k2d64bv_isa.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("popcnt,avx2,bmi2")
+#define KERNEL_ISA _avx2
+#include "k2d64bv_isa.h"
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("popcnt,avx2,bmi2,avx512f,avx512bw,avx512vpopcntdq")
+#define KERNEL_ISA _avx512
+#include "k2d64bv_isa.h"
+#pragma GCC pop_options
+#else
+// a single clone built with the flags of the Makefile
+#define KERNEL_ISA _base
+#include "k2d64bv_isa.h"
+#endif
+
+// clone of the kernels for an instruction set
+typedef struct isa {
+  const char *name;
+  const char *features;
+  const kernel_t *kernels;
+} isa_t;
+
+// from the most demanding instruction set to the baseline
+static const isa_t isas[] = {
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+  { "avx512", "AVX-512F/BW/VPOPCNTDQ, AVX2, BMI2, POPCNT", kernels_avx512 },
+  { "avx2",   "AVX2, BMI2, POPCNT", kernels_avx2 },
+  { "base",   "POPCNT", kernels_base },
+#else
+  { "base",   "flags of the build", kernels_base },
+#endif
+  { NULL, NULL, NULL }
+};
+
+// NSEQS (make s=...) and DUAL_PREFETCH (make p=...) select the default kernel
+#if (NSEQS != 2) && (NSEQS != 4) && (NSEQS != 6) && (NSEQS != 8) && (NSEQS != 12) && \
+    (NSEQS != 16) && (NSEQS != 20) && (NSEQS != 24) && (NSEQS != 32) && (NSEQS != 40)
+    #error "NSEQS must be one of 2, 4, 6, 8, 12, 16, 20, 24, 32, 40"
+#endif
+
+#ifdef DUAL_PREFETCH
+    #define DEFAULT_DUAL 1
+#else
+    #define DEFAULT_DUAL 0
+#endif
+
+// sequences per thread of the calibration batch (--nseqs auto)
+#define CALIBRATION_SEQS 4096
+#define CALIBRATION_RUNS 3
+
+// clone of the kernels for the host (-i) and kernel run by the search
+// (NULL: chosen by calibrate())
+static const isa_t *isa = NULL;
+static const kernel_t *kernels = NULL;
+static const kernel_t *kernel = NULL;
+// kernels considered by --nseqs auto (-1: all, 0: scalar, 1: vector)
+static int kernel_kind = -1;
+static int nseqs_auto = 0;
+
+// 1 if the host supports the instruction set of a clone
+static int
+isa_supported(const isa_t *clone)
 {
-  uint th_bl_size, total = 0;
-  uint64_t lf = 0;
+#if defined(__GNUC__) && !defined(__INTEL_COMPILER)
+  __builtin_cpu_init();
+  int popcnt = __builtin_cpu_supports("popcnt");
+  int avx2 = popcnt && __builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2");
+
+  if (strcmp(clone->name, "avx512") == 0)
+    return avx2 && __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+           __builtin_cpu_supports("avx512vpopcntdq");
+  if (strcmp(clone->name, "avx2") == 0)
+    return avx2;
+  return popcnt;
+#else
+  (void) clone;
+  return 1;
+#endif
+}
+
+// kernel run by a thread (-n core: sized for its core)
+static inline const kernel_t *
+thread_kernel(uint thread_id)
+{
+  return (thread_kernels != NULL)? thread_kernels[thread_id] : kernel;
+}
+
+static const kernel_t *
+find_kernel(uint nseqs, int dual, int vector)
+{
+  for (const kernel_t *k = kernels; k->run != NULL; k++)
+    if ((k->nseqs == nseqs) && ((k->lanes > 0) == vector) && (vector || (k->dual == dual)))
+      return k;
+  return NULL;
+}
+
+static void
+print_kernel(const kernel_t *k)
+{
+  printf("- Instruction set: %s (%s)\n", isa->name, isa->features);
+  printf("- Kernel: %s, %u overlapped sequences", k->lanes? "vector" : "scalar", k->nseqs);
+  if (k->lanes)
+    printf(" (%u lanes, %u slots)\n", k->lanes, ((k->nseqs + k->lanes - 1)/k->lanes)*k->lanes);
+  else
+    printf(" (%s prefetch)\n", k->dual? "L2+L1" : "L2");
+}
+
+// cpus of the threads for the placement policy (-B), or the cpus of the
+// process in increasing order (round robin); returns the number of cpus
+static int
+bind_map(void)
+{
+  cpu_topo_t *topo = malloc(CPU_SETSIZE*sizeof(cpu_topo_t));
+  int ncpus;
+
+  bind_cpus = malloc(nthreads*sizeof(int));
+  if ((topo == NULL) || (bind_cpus == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  ncpus = read_topology(topo, CPU_SETSIZE);
+  if (ncpus <= 0)
+  {
+    printf("ERROR: cannot read the cpus of the process\n");
+    exit(EXIT_FAILURE);
+  }
+  if (bind_policy >= 0) sort_topology(topo, ncpus, bind_policy);
+  for (uint t = 0; t < nthreads; t++)
+    bind_cpus[t] = topo[t % ncpus].cpu;
+
+  free(topo);
+  return ncpus;
+}
+
+// pins the threads of the OpenMP team to their cpus (the pool pins its own
+// threads) and prints the map
+static void
+bind_threads(int verbose)
+{
+  cpu_topo_t *topo = malloc(CPU_SETSIZE*sizeof(cpu_topo_t));
+  int *placed = malloc(nthreads*sizeof(int));
+  int ncpus;
+
+  if ((topo == NULL) || (placed == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  ncpus = read_topology(topo, CPU_SETSIZE);
+  bind_map();
+
+  // libgomp keeps the threads of a team of the same size: pinned once
+  omp_set_num_threads(nthreads);
+  #pragma omp parallel
+  {
+    uint thread_id = omp_get_thread_num();
+    placed[thread_id] = (bind_to_cpu(bind_cpus[thread_id]) == 0)? sched_getcpu() : -1;
+  }
+
+  if (verbose)
+  {
+    printf("Thread binding\n");
+    printf("- Policy: %s (%d cpus)\n", bind_names[bind_policy], ncpus);
+    for (uint t = 0; t < nthreads; t++)
+    {
+      const cpu_topo_t *c = topo;
+      while (c->cpu != bind_cpus[t]) c++;
+      printf("- th.%3u -> cpu %3d (socket %d, core %3d, smt %d)", t, c->cpu, c->socket, c->core, c->smt);
+      if (!pool.enabled && (placed[t] != c->cpu))
+        printf(" WARNING: running on cpu %d", placed[t]);
+      printf("\n");
+    }
+    if (nthreads > (uint) ncpus)
+      printf("WARNING: %u threads share %d cpus\n", nthreads, ncpus);
+    printf(HLINE);
+  }
+  free(placed);
+  free(topo);
+}
+
+// allocates the counters of the threads
+static void
+init_thread_stats(void)
+{
+  if (thread_stats != NULL) return;
+  thread_stats = aligned_alloc(BYTES_PER_CACHE_BLOCK, nthreads*sizeof(thread_stats_t));
+  if (thread_stats == NULL)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(thread_stats, 0, nthreads*sizeof(thread_stats_t));
+}
+
+// free slots of a physical core (-S), in its own cache block
+typedef struct core_slots {
+  uint tokens;
+} __attribute__ ((aligned(BYTES_PER_CACHE_BLOCK))) core_slots_t;
+
+// sizes the kernel of each thread so that the overlapped sequences of the
+// threads sharing a physical core add up to core_seqs (-n core); with -S,
+// every thread runs the kernel of the whole core and the threads of a core
+// take their slots from a shared budget of core_seqs
+static void
+plan_slots(int verbose)
+{
+  int dual = kernel->dual, vector = (kernel->lanes > 0);
+  cpu_topo_t *topo = malloc(CPU_SETSIZE*sizeof(cpu_topo_t));
+  uint *core_of = malloc(nthreads*sizeof(uint));
+  uint *sharing = calloc(nthreads, sizeof(uint));
+  int *core_cpu = malloc(nthreads*sizeof(int));
+  uint ncores = 0, max_sharing = 0;
+  int ncpus;
+
+  thread_kernels = malloc(nthreads*sizeof(kernel_t*));
+  if ((topo == NULL) || (core_of == NULL) || (sharing == NULL) || (core_cpu == NULL) ||
+      (thread_kernels == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  init_thread_stats();
+  ncpus = read_topology(topo, CPU_SETSIZE);
+  if (bind_cpus == NULL) bind_map();
+
+  // physical core of each thread (threads not pinned: placed as in the
+  // round robin of bind_map())
+  for (uint t = 0; t < nthreads; t++)
+  {
+    const cpu_topo_t *c = topo;
+    uint core;
+    while ((c < topo + ncpus - 1) && (c->cpu != bind_cpus[t])) c++;
+    for (core = 0; core < ncores; core++)
+    {
+      const cpu_topo_t *d = topo;
+      while (d->cpu != core_cpu[core]) d++;
+      if ((d->socket == c->socket) && (d->core == c->core)) break;
+    }
+    if (core == ncores) core_cpu[ncores++] = c->cpu;
+    core_of[t] = core;
+    if (++sharing[core] > max_sharing) max_sharing = sharing[core];
+  }
+
+  // largest kernel within the budget of the thread
+  for (uint t = 0; t < nthreads; t++)
+  {
+    uint budget = share_slots? core_seqs : core_seqs/sharing[core_of[t]];
+    const kernel_t *best = NULL;
+    for (const kernel_t *k = kernels; k->run != NULL; k++)
+    {
+      if (((k->lanes > 0) != vector) || (!vector && (k->dual != dual))) continue;
+      if ((best == NULL) || ((k->nseqs <= budget) && (k->nseqs > best->nseqs)) ||
+          ((best->nseqs > budget) && (k->nseqs < best->nseqs)))
+        best = k;
+    }
+    thread_kernels[t] = best;
+  }
+  kernel = thread_kernels[0];
+
+  if (share_slots)
+  {
+    core_slots = aligned_alloc(BYTES_PER_CACHE_BLOCK, ncores*sizeof(core_slots_t));
+    if (core_slots == NULL)
+    {
+      printf("Error at malloc\n");
+      exit(EXIT_FAILURE);
+    }
+    for (uint core = 0; core < ncores; core++)
+      core_slots[core].tokens = core_seqs;
+    for (uint t = 0; t < nthreads; t++)
+      thread_stats[t].tokens = &core_slots[core_of[t]].tokens;
+  }
+
+  if (verbose)
+  {
+    printf("Slots per core\n");
+    printf("- Overlapped sequences per core: %u%s\n", core_seqs,
+           share_slots? " (shared by the threads of the core)" : "");
+    printf("- Physical cores: %u, up to %u threads per core%s\n", ncores, max_sharing,
+           (bind_policy < 0)? " (threads not pinned: estimated)" : "");
+    for (uint n = 1; n <= max_sharing; n++)
+    {
+      uint cores = 0, t;
+      for (uint core = 0; core < ncores; core++) cores += (sharing[core] == n);
+      if (cores == 0) continue;
+      for (t = 0; sharing[core_of[t]] != n; t++) ;
+      printf("- %u cores with %u threads: kernel of %u overlapped sequences per thread\n",
+             cores, n, thread_kernels[t]->nseqs);
+    }
+    printf(HLINE);
+  }
+  free(core_cpu);
+  free(sharing);
+  free(core_of);
+  free(topo);
+}
+
+// batch searched by the OpenMP team
+static batch_t *team_batch = NULL;
+
+// next chunk of the batch of the team: taken from the shared cursor (-c) or,
+// with -c 0, the contiguous block of the thread (static split)
+static int
+cursor_chunk(chunk_t *chunk)
+{
+  uint count = team_batch->count;
+
+  if (chunk_size == 0)
+  {
+    uint thread_id = omp_get_thread_num(), th_threads = omp_get_num_threads();
+    if (thread_stats[thread_id].taken) return 0;
+    thread_stats[thread_id].taken = 1;
+    chunk->begin = (uint)((uint64_t) count*thread_id/th_threads);
+    chunk->end   = (uint)((uint64_t) count*(thread_id + 1)/th_threads);
+  }
+  else
+  {
+    // idle slots poll the cursor: do not move it past the end
+    if (__atomic_load_n(&chunk_cursor, __ATOMIC_RELAXED) >= count) return 0;
+    chunk->begin = __atomic_fetch_add(&chunk_cursor, chunk_size, __ATOMIC_RELAXED);
+    if (chunk->begin >= count) return 0;
+    chunk->end = (count - chunk->begin > chunk_size)? chunk->begin + chunk_size : count;
+  }
+  chunk->batch = team_batch;
+  return 1;
+}
+
+// searches a batch of sequences in an OpenMP parallel region with a kernel
+// (NULL: the kernel of each thread)
+static uint64_t
+search_team(const kernel_t *k, batch_t *batch, double *glfops)
+{
+  uint64_t lf = 0, unique = 0, saved = 0, empty = 0, skipped = 0;
+  uint64_t probes = 0, hits = 0, cached = 0, filtered = 0, fsaved = 0, zeros = 0;
   double lfops = 0.0;
 
-  omp_set_num_threads(nthreads);
-  th_bl_size = count/nthreads;
+  init_thread_stats();
+  omp_set_num_threads(nthreads);
+  team_batch = batch;
+  chunk_cursor = 0;
+
+  #pragma omp parallel reduction(+:lf, lfops, unique, saved, empty, skipped, probes, hits, cached) \
+                       reduction(+:filtered, fsaved, zeros)
+  {
+    uint thread_id = omp_get_thread_num();
+    thread_stats_t *stats = &thread_stats[thread_id];
+
+#if DEBUG_THREADS
+    uint32_t cpu_num, node_num;
+    int status;
+    status = syscall(SYS_getcpu, &cpu_num, &node_num, NULL);
+    if  (status != -1)
+    {
+        // int cpu_num = sched_getcpu();
+        printf("  th.%2u -> core %2u -> node %u\n", thread_id, cpu_num, node_num);
+    }
+#endif
+
+    stats->taken = 0;
+    #pragma omp barrier
+    ((k != NULL)? k : thread_kernel(thread_id))->run(cursor_chunk, 0, stats);
+
+    lf += stats->lf;
+    unique += stats->unique;
+    saved += stats->saved;
+    empty += stats->empty;
+    skipped += stats->skipped;
+    probes += stats->probes;
+    hits += stats->hits;
+    cached += stats->cached;
+    filtered += stats->filtered;
+    fsaved += stats->fsaved;
+    zeros += stats->zeros;
+    lfops += stats->lf/(stats->end - stats->start);
+  } //#pragma omp parallel
+
+  (*glfops) = lfops/GIGA;
+  unique_reads = unique;
+  unique_saved = saved;
+  empty_reads = empty;
+  empty_skipped = skipped;
+  cache_probes = probes;
+  cache_hits = hits;
+  cache_saved = cached;
+  filter_reads = filtered;
+  filter_saved = fsaved;
+  filter_zeros = zeros;
+  return lf;
+}
+
+// next chunk of the queue of the pool: consumers race for the head with a CAS
+// (a slot overwritten by the producer meanwhile is discarded by the CAS)
+static int
+pool_chunk(chunk_t *chunk)
+{
+  uint head = __atomic_load_n(&pool.head, __ATOMIC_ACQUIRE);
+
+  do
+  {
+    if (head == __atomic_load_n(&pool.tail, __ATOMIC_ACQUIRE)) return 0;
+    *chunk = pool.ring[head % POOL_RING];
+  } while (!__atomic_compare_exchange_n(&pool.head, &head, head + 1, 1,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+  return 1;
+}
+
+// adds a chunk to the queue of the pool (main thread only)
+static void
+pool_push(batch_t *batch, uint begin, uint end)
+{
+  while (pool.tail - __atomic_load_n(&pool.head, __ATOMIC_ACQUIRE) >= POOL_RING)
+    sched_yield();
+  pool.ring[pool.tail % POOL_RING] = (chunk_t) { batch, begin, end };
+  __atomic_store_n(&pool.tail, pool.tail + 1, __ATOMIC_RELEASE);
+}
+
+static void *
+pool_worker(void *arg)
+{
+  thread_stats_t *stats = arg;
+
+  bind_to_cpu(bind_cpus[stats - thread_stats]);
+  thread_kernel(stats - thread_stats)->run(pool_chunk, 1, stats);
+  return NULL;
+}
+
+// starts nthreads persistent workers, each one pinned to its cpu (--bind, or
+// round robin over the cpus of the process)
+static void
+pool_start(void)
+{
+  init_thread_stats();
+  if (bind_cpus == NULL) bind_map();
+  pool.threads = malloc(nthreads*sizeof(pthread_t));
+  if (pool.threads == NULL)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+
+  for (uint t = 0; t < nthreads; t++)
+  {
+    if (pthread_create(&pool.threads[t], NULL, pool_worker, &thread_stats[t]) != 0)
+    {
+      printf("Error creating thread %u of the pool\n", t);
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+static void
+pool_finish(void)
+{
+  __atomic_store_n(&pool.stop, 1, __ATOMIC_RELEASE);
+  for (uint t = 0; t < nthreads; t++)
+    pthread_join(pool.threads[t], NULL);
+  free(pool.threads);
+}
+
+// LF lookup of the breadth-first engine: entry of the BWT, offset of the row
+// in its block and bound it computes (2*read: start, 2*read + 1: end)
+typedef struct lookup {
+  uint64_t entry;
+  uint32_t ref;
+  uint32_t offset;
+} lookup_t;
+
+// buffers of a thread of the breadth-first engine (bfs_seqs reads), indexed
+// by the position of the read in the order of the walk
+typedef struct bfs_buffers {
+  uint64_t *bounds;     // start and end of each read
+  int *index;           // next pair of characters of each read
+  uint *order;          // read of each position (-e trie: sorted by reversed sequence)
+  uint *lcp;            // characters of the suffix shared with the previous read
+  uint *pending;        // reads not finished
+  uint *pending_lcp;    // suffix shared with the previous pending read
+  lookup_t *lookups, *tmp;
+} bfs_buffers_t;
+
+// order of the reads of the trie (-e trie): by parity of the length (the
+// LUT prefixes differ) and by reversed sequence, a read before the longer
+// ones that end with it
+static int
+compare_suffix(const void *a, const void *b, void *arg)
+{
+  const batch_t *batch = arg;
+  uint ra = *(const uint*) a, rb = *(const uint*) b;
+  uint la = batch->lines_len[ra], lb = batch->lines_len[rb];
+  const unsigned char *sa = (const unsigned char*) batch->lines[ra] + la;
+  const unsigned char *sb = (const unsigned char*) batch->lines[rb] + lb;
+
+  if ((la % 2) != (lb % 2)) return (int)(la % 2) - (int)(lb % 2);
+  for (int i = 1; (i <= (int) la) && (i <= (int) lb); i++)
+    if (sa[-i] != sb[-i]) return (int) sa[-i] - (int) sb[-i];
+  return (la > lb) - (la < lb);
+}
+
+// characters of the suffix shared by two reads (0 if their LUT prefixes differ)
+static uint
+shared_suffix(const batch_t *batch, uint ra, uint rb)
+{
+  uint la = batch->lines_len[ra], lb = batch->lines_len[rb], c = 0;
+  const char *sa = batch->lines[ra] + la, *sb = batch->lines[rb] + lb;
+
+  if ((la % 2) != (lb % 2)) return 0;
+  while ((c < la) && (c < lb) && (sa[-1 - (int) c] == sb[-1 - (int) c])) c++;
+  return c;
+}
+
+// sorts the lookups by entry (LSD radix sort, digits of BFS_RADIX_BITS bits),
+// returns a or tmp, whichever holds the result
+static lookup_t *
+radix_sort_lookups(lookup_t *a, lookup_t *tmp, uint n, uint64_t max_entry)
+{
+  uint count[1 << BFS_RADIX_BITS];
+  const uint64_t digit_mask = (1 << BFS_RADIX_BITS) - 1;
+
+  for (uint shift = 0; (shift == 0) || ((max_entry >> shift) > 0); shift += BFS_RADIX_BITS)
+  {
+    uint sum = 0;
+    memset(count, 0, sizeof(count));
+    for (uint i = 0; i < n; i++)
+      count[(a[i].entry >> shift) & digit_mask]++;
+    for (uint d = 0; d <= digit_mask; d++)
+    {
+      uint c = count[d];
+      count[d] = sum;
+      sum += c;
+    }
+    for (uint i = 0; i < n; i++)
+      tmp[count[(a[i].entry >> shift) & digit_mask]++] = a[i];
+
+    lookup_t *swap = a;
+    a = tmp;
+    tmp = swap;
+  }
+  return a;
+}
+
+// searches the reads [begin, end) of a batch breadth-first: every round
+// advances all the pending reads by one k2 step, and their LF lookups are
+// sorted by entry so that the BWT is swept in address order.
+// With -e trie, the reads are walked as an implicit trie of their suffixes:
+// sorted by reversed sequence, a read that shares with the previous pending
+// read the suffix processed so far takes its interval instead of computing it
+static void
+bfs_segment(batch_t *batch, uint begin, uint end, bfs_buffers_t *buf, thread_stats_t *stats)
+{
+  const uint64_t max_entry = (fmi.len/D_VAL + 1)*K2_SYMBOLS;
+  uint64_t *bounds = buf->bounds, total = 0;
+  uint *order = buf->order, *pending_lcp = buf->pending_lcp;
+  int *index = buf->index;
+  uint n = end - begin, npending = 0, run = 0;
+
+  for (uint p = 0; p < n; p++)
+    order[p] = begin + p;
+  if (engine_trie)
+  {
+    qsort_r(order, n, sizeof(uint), compare_suffix, batch);
+    buf->lcp[0] = 0;
+    for (uint p = 1; p < n; p++)
+      buf->lcp[p] = shared_suffix(batch, order[p-1], order[p]);
+  }
+  else
+    memset(buf->lcp, 0, n*sizeof(uint));
+
+  // starting intervals (LUT)
+  for (uint p = 0; p < n; p++)
+  {
+    char *line = batch->lines[order[p]];
+    uint len = batch->lines_len[order[p]];
+    uint8_t *packed = read_store + batch->offsets[order[p]];
+    uint lut_index_len = 6 - (len % 2);
+    uint lut_index = *((uint16_t*) packed) & ((1U << (BITS_PER_SYMBOL*lut_index_len)) - 1);
+
+    stats->lf += lut_index_len*2;
+    bounds[2*p]     = fmi.LUT[len % KSTEPS][lut_index].start;
+    bounds[2*p + 1] = fmi.LUT[len % KSTEPS][lut_index].end + 1;
+    index[p] = (int)(len - KSTEPS - lut_index_len);
+    // suffix shared with the previous pending read: the minimum along the reads
+    // that leave the walk in between
+    if (buf->lcp[p] < run) run = buf->lcp[p];
+    if (bloom_kmers && !bloom_SFM(&fmi, line, len, bloom_kmers))
+    {
+      // a k-mer is not in the reference: no occurrences
+      stats->filtered++;
+      stats->fsaved += 2*len;
+      stats->lf -= lut_index_len*2;
+      bounds[2*p] = bounds[2*p + 1] = 0;
+    }
+    else if (bounds[2*p] >= bounds[2*p + 1])
+    {
+      // empty interval: the rest of the LF steps are skipped
+      stats->empty++;
+      stats->skipped += 2*(index[p] + KSTEPS);
+      bounds[2*p + 1] = bounds[2*p];
+    }
+    else if (index[p] >= 0)
+    {
+      pending_lcp[npending] = run;
+      buf->pending[npending++] = p;
+      run = UINT_MAX;
+    }
+  }
+
+  for (uint round = 1; npending > 0; round++)
+  {
+    uint m = 0, still = 0, prev = 0;
+
+    // LF lookups of the next pair of characters of every pending read (of the
+    // first read of each trie node)
+    for (uint i = 0; i < npending; i++)
+    {
+      uint p = buf->pending[i];
+      uint len = batch->lines_len[order[p]];
+      if ((i > 0) && (pending_lcp[i] >= 6 - (len % 2) + KSTEPS*round)) continue;
+
+      uint64_t base = (uint64_t)(uintptr_t)(read_store + batch->offsets[order[p]])*8 +
+                      BITS_PER_SYMBOL*(len - KSTEPS);
+      uint8_t symbol = PACKED_SYMBOL(base, index[p]);
+      for (uint b = 0; b < 2; b++)
+      {
+        uint64_t row = bounds[2*p + b];
+        buf->lookups[m++] = (lookup_t) { (row/D_VAL)*K2_SYMBOLS + symbol, 2*p + b, row % D_VAL };
+      }
+    }
+    stats->lf += (uint64_t) m*KSTEPS;
+
+    // sweep of the entries in address order
+    lookup_t *sorted = radix_sort_lookups(buf->lookups, buf->tmp, m, max_entry);
+    for (uint i = 0; i < m; i++)
+    {
+      const SFM_entry_t *entry = &fmi.entries[sorted[i].entry];
+      _mm_prefetch((char*) &fmi.entries[sorted[(i + BFS_PREFETCH < m)? i + BFS_PREFETCH : i].entry],
+                   PREFETCH_HINT_L1);
+      bounds[sorted[i].ref] = entry->counter + _popcnt64(entry->data & mask_64b[sorted[i].offset]);
+    }
+
+    // reads finished or with an empty interval leave the pending list
+    run = 0;
+    for (uint i = 0; i < npending; i++)
+    {
+      uint p = buf->pending[i];
+      uint len = batch->lines_len[order[p]];
+      if ((i > 0) && (pending_lcp[i] >= 6 - (len % 2) + KSTEPS*round))
+      {
+        // same trie node as the previous pending read
+        bounds[2*p]     = bounds[2*prev];
+        bounds[2*p + 1] = bounds[2*prev + 1];
+        stats->shared += 2*KSTEPS;
+      }
+      if (pending_lcp[i] < run) run = pending_lcp[i];
+      prev = p;
+
+      index[p] -= KSTEPS;
+      if (bounds[2*p] >= bounds[2*p + 1])
+      {
+        stats->empty += (index[p] >= 0);
+        stats->skipped += (index[p] >= 0)*2*(index[p] + KSTEPS);
+        bounds[2*p + 1] = bounds[2*p];
+      }
+      else if (index[p] >= 0)
+      {
+        pending_lcp[still] = run;
+        buf->pending[still++] = p;
+        run = UINT_MAX;
+      }
+    }
+    npending = still;
+  }
+
+  for (uint p = 0; p < n; p++)
+  {
+    total += bounds[2*p + 1] - bounds[2*p];
+    stats->zeros += (bounds[2*p + 1] == bounds[2*p]);
+    if (batch->intervals != NULL)
+    {
+      batch->intervals[order[p]].start = bounds[2*p];
+      batch->intervals[order[p]].end   = bounds[2*p + 1];
+    }
+  }
+  __atomic_fetch_add(&batch->total, total, __ATOMIC_RELAXED);
+  __atomic_fetch_sub(&batch->pending, n, __ATOMIC_RELEASE);
+}
+
+// searches a batch with the breadth-first engine in an OpenMP parallel region:
+// the threads take segments of bfs_seqs reads from a shared cursor
+static uint64_t
+search_bfs(batch_t *batch, double *glfops)
+{
+  uint64_t lf = 0, empty = 0, skipped = 0, shared = 0, filtered = 0, fsaved = 0, zeros = 0;
+  double lfops = 0.0;
+
+  init_thread_stats();
+  omp_set_num_threads(nthreads);
+  chunk_cursor = 0;
+
+  #pragma omp parallel reduction(+:lf, lfops, empty, skipped, shared, filtered, fsaved, zeros)
+  {
+    thread_stats_t *stats = &thread_stats[omp_get_thread_num()];
+    uint size = (batch->count < bfs_seqs)? batch->count : bfs_seqs;
+    bfs_buffers_t buf;
+    uint begin;
+
+    buf.bounds = malloc(2*size*sizeof(uint64_t));
+    buf.index = malloc(size*sizeof(int));
+    buf.order = malloc(size*sizeof(uint));
+    buf.lcp = malloc(size*sizeof(uint));
+    buf.pending = malloc(size*sizeof(uint));
+    buf.pending_lcp = malloc(size*sizeof(uint));
+    buf.lookups = malloc(2*size*sizeof(lookup_t));
+    buf.tmp = malloc(2*size*sizeof(lookup_t));
+    if ((buf.bounds == NULL) || (buf.index == NULL) || (buf.order == NULL) || (buf.lcp == NULL) ||
+        (buf.pending == NULL) || (buf.pending_lcp == NULL) || (buf.lookups == NULL) || (buf.tmp == NULL))
+    {
+      printf("Error at malloc\n");
+      exit(EXIT_FAILURE);
+    }
+
+    stats->lf = stats->empty = stats->skipped = stats->shared = 0;
+    stats->filtered = stats->fsaved = stats->zeros = 0;
+    stats->start = omp_get_wtime();
+    while ((begin = __atomic_fetch_add(&chunk_cursor, size, __ATOMIC_RELAXED)) < batch->count)
+      bfs_segment(batch, begin, (batch->count - begin > size)? begin + size : batch->count,
+                  &buf, stats);
+    stats->end = omp_get_wtime();
+
+    lf += stats->lf;
+    empty += stats->empty;
+    skipped += stats->skipped;
+    shared += stats->shared;
+    filtered += stats->filtered;
+    fsaved += stats->fsaved;
+    zeros += stats->zeros;
+    lfops += stats->lf/(stats->end - stats->start);
+    free(buf.bounds);
+    free(buf.index);
+    free(buf.order);
+    free(buf.lcp);
+    free(buf.pending);
+    free(buf.pending_lcp);
+    free(buf.lookups);
+    free(buf.tmp);
+  } //#pragma omp parallel
+
+  (*glfops) = lfops/GIGA;
+  unique_reads = unique_saved = 0;
+  cache_probes = cache_hits = cache_saved = 0;
+  filter_reads = filtered;
+  filter_saved = fsaved;
+  filter_zeros = zeros;
+  empty_reads = empty;
+  empty_skipped = skipped;
+  trie_shared = shared;
+  return lf;
+}
+
+// sum of a counter of the threads of the pool
+#define POOL_STAT(FIELD) ({                                                    \
+  uint64_t sum_ = 0;                                                           \
+  for (uint t_ = 0; t_ < nthreads; t_++)                                       \
+    sum_ += __atomic_load_n(&thread_stats[t_].FIELD, __ATOMIC_RELAXED);        \
+  sum_; })
+
+// searches the sequences in batches of batch_size sequences (-b): with --pool,
+// all the batches are queued and the workers move from one to the next without
+// draining their slots; otherwise, each batch is searched by an OpenMP team
+static uint64_t
+search(char **lines, uint *lines_len, uint64_t *offsets, uint count, uint *found, double *glfops)
+{
+  uint size = ((batch_size == 0) || (batch_size > count))? count : batch_size;
+  uint nbatches = (size > 0)? (count + size - 1)/size : 0;
+  uint64_t lf = 0, total = 0, unique = 0, saved = 0, empty = 0, skipped = 0, shared = 0;
+  uint64_t probes = 0, hits = 0, cached = 0, filtered = 0, fsaved = 0, zeros = 0;
+  double start_timer = omp_get_wtime(), team_glfops = 0.0;
+  batch_t *batches;
+
+  batches = malloc((nbatches + 1)*sizeof(batch_t));
+  if (batches == NULL)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  if (pool.enabled)
+  {
+    lf = POOL_STAT(lf);
+    unique = POOL_STAT(unique);
+    saved = POOL_STAT(saved);
+    empty = POOL_STAT(empty);
+    skipped = POOL_STAT(skipped);
+    probes = POOL_STAT(probes);
+    hits = POOL_STAT(hits);
+    cached = POOL_STAT(cached);
+    filtered = POOL_STAT(filtered);
+    fsaved = POOL_STAT(fsaved);
+    zeros = POOL_STAT(zeros);
+  }
+
+  for (uint b = 0; b < nbatches; b++)
+  {
+    uint begin = b*size, n = (count - begin < size)? count - begin : size;
+    batches[b] = (batch_t) { lines + begin, lines_len + begin, offsets + begin, n,
+                             (intervals != NULL)? intervals + begin : NULL, 0, n };
+    if (!pool.enabled)
+    {
+      lf += engine_bfs? search_bfs(&batches[b], &team_glfops) :
+                        search_team(NULL, &batches[b], &team_glfops);
+      unique += unique_reads;
+      saved += unique_saved;
+      empty += empty_reads;
+      skipped += empty_skipped;
+      shared += trie_shared;
+      probes += cache_probes;
+      hits += cache_hits;
+      cached += cache_saved;
+      filtered += filter_reads;
+      fsaved += filter_saved;
+      zeros += filter_zeros;
+      continue;
+    }
+    // chunks of the batch (a single one with -c 0)
+    uint step = (chunk_size > 0)? chunk_size : n;
+    for (uint c = 0; c < n; c += step)
+      pool_push(&batches[b], c, (n - c > step)? c + step : n);
+  }
+
+  for (uint b = 0; b < nbatches; b++)
+  {
+    while (__atomic_load_n(&batches[b].pending, __ATOMIC_ACQUIRE) > 0)
+      sched_yield();
+    total += batches[b].total;
+  }
+
+  if (pool.enabled)
+  {
+    lf = POOL_STAT(lf) - lf;
+    unique = POOL_STAT(unique) - unique;
+    saved = POOL_STAT(saved) - saved;
+    empty = POOL_STAT(empty) - empty;
+    skipped = POOL_STAT(skipped) - skipped;
+    probes = POOL_STAT(probes) - probes;
+    hits = POOL_STAT(hits) - hits;
+    cached = POOL_STAT(cached) - cached;
+    filtered = POOL_STAT(filtered) - filtered;
+    fsaved = POOL_STAT(fsaved) - fsaved;
+    zeros = POOL_STAT(zeros) - zeros;
+  }
+  unique_reads = unique;
+  unique_saved = saved;
+  empty_reads = empty;
+  empty_skipped = skipped;
+  trie_shared = shared;
+  cache_probes = probes;
+  cache_hits = hits;
+  cache_saved = cached;
+  filter_reads = filtered;
+  filter_saved = fsaved;
+  filter_zeros = zeros;
+  (*found) = total;
+  // a single team: sum of the throughput of the threads
+  (*glfops) = ((nbatches == 1) && !pool.enabled)? team_glfops : lf/(omp_get_wtime() - start_timer)/GIGA;
+  free(batches);
+  return lf;
+}
+
+// times the kernels on a sample of the sequences and returns the fastest one
+static const kernel_t *
+calibrate(char **lines, uint *lines_len, uint64_t *offsets, uint count, int verbose)
+{
+  const kernel_t *best = NULL;
+  double best_time = DBL_MAX, start_timer;
+  uint n = count;
+  double glfops;
+
+  if (n > CALIBRATION_SEQS*nthreads) n = CALIBRATION_SEQS*nthreads;
+  char **cal_lines = malloc((n+1)*sizeof(char*));
+  uint *cal_lens = malloc((n+1)*sizeof(uint));
+  uint64_t *cal_offsets = malloc((n+1)*sizeof(uint64_t));
+  if ((cal_lines == NULL) || (cal_lens == NULL) || (cal_offsets == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  // sequences evenly spaced along the file
+  for (uint i = 0; i < n; i++)
+  {
+    uint j = (uint)((uint64_t) i*count/n);
+    cal_lines[i] = lines[j];
+    cal_lens[i] = lines_len[j];
+    cal_offsets[i] = offsets[j];
+  }
+
+  if (verbose)
+  {
+    printf("Calibration: %u sequences, best of %d runs per kernel\n", n, CALIBRATION_RUNS);
+    printf("  kernel  nseqs  prefetch     Mseq/s\n");
+  }
+  for (const kernel_t *k = kernels; k->run != NULL; k++)
+  {
+    if ((kernel_kind >= 0) && ((k->lanes > 0) != kernel_kind)) continue;
+    if (unique_mode && k->lanes) continue;
+
+    double time = DBL_MAX;
+    for (int run = 0; run < CALIBRATION_RUNS; run++)
+    {
+      batch_t batch = { cal_lines, cal_lens, cal_offsets, n, NULL, 0, n };
+      start_timer = omp_get_wtime();
+      search_team(k, &batch, &glfops);
+      double t = omp_get_wtime() - start_timer;
+      if (t < time) time = t;
+    }
+    if (verbose)
+      printf("  %-6s  %5u  %-8s %9.3f\n", k->lanes? "vector" : "scalar", k->nseqs,
+             k->lanes? "-" : (k->dual? "L2+L1" : "L2"), n/(MEGA*time));
+    if (time < best_time)
+    {
+      best_time = time;
+      best = k;
+    }
+  }
+  if (verbose) printf(HLINE);
+
+  free(cal_lines);
+  free(cal_lens);
+  free(cal_offsets);
+  return best;
+}
+
+// per-read occurrences in each sequence of the collection
+static uint64_t
+count_docs(uint *lines_len, uint count, FILE *fp)
+{
+  uint64_t located = 0;
+  char **buffers;
+  size_t *buffers_len;
+
+  omp_set_num_threads(nthreads);
+  buffers = calloc(nthreads, sizeof(char*));
+  buffers_len = calloc(nthreads, sizeof(size_t));
+  if ((buffers == NULL) || (buffers_len == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+
+  #pragma omp parallel reduction(+:located)
+  {
+    uint64_t rows[LOCATE_BATCH], pos[LOCATE_BATCH];
+    uint owner[LOCATE_BATCH];
+    uint64_t *hits = calloc(fmi.n_seqs, sizeof(uint64_t));
+    uint32_t *touched = malloc(fmi.n_seqs*sizeof(uint32_t));
+    uint n_touched = 0, n_rows = 0, current = count;
+    uint thread_id = omp_get_thread_num();
+    uint th_threads = omp_get_num_threads();
+    FILE *out = open_memstream(&buffers[thread_id], &buffers_len[thread_id]);
+
+    if ((hits == NULL) || (touched == NULL) || (out == NULL))
+    {
+      printf("Error at malloc\n");
+      exit(EXIT_FAILURE);
+    }
+
+    // contiguous blocks of reads keep the output in read order
+    uint bl_begin = (uint)((uint64_t) count*thread_id/th_threads);
+    uint bl_end   = (uint)((uint64_t) count*(thread_id + 1)/th_threads);
+
+    for (uint i = bl_begin; i <= bl_end; i++)
+    {
+      uint64_t row = (i < bl_end)? intervals[i].start : 0;
+      uint64_t row_end = (i < bl_end)? intervals[i].end : 0;
+
+      while ((row < row_end) || ((i == bl_end) && (n_rows > 0)))
+      {
+        if (row < row_end)
+        {
+          rows[n_rows] = row++;
+          owner[n_rows++] = i;
+        }
+        if ((n_rows < LOCATE_BATCH) && (i < bl_end)) continue;
+
+        // batch of rows: interleaved and prefetched LF walks
+        locate_SFM(&fmi, rows, pos, n_rows);
+        located += n_rows;
+
+        for (uint k = 0; k < n_rows; k++)
+        {
+          if (owner[k] != current)
+          {
+            for (uint g = 0; g < n_touched; g++)
+            {
+              fprintf(out, "%u\t%s\t%lu\n", current, fmi.seq_names[touched[g]], hits[touched[g]]);
+              hits[touched[g]] = 0;
+            }
+            n_touched = 0;
+            current = owner[k];
+          }
+          uint32_t seq = seq_of_pos_SFM(&fmi, pos[k]);
+          // discard occurrences spanning two sequences
+          if (pos[k] + lines_len[current] <= fmi.seq_bounds[seq+1])
+          {
+            if (hits[seq] == 0) touched[n_touched++] = seq;
+            hits[seq]++;
+          }
+        }
+        n_rows = 0;
+      }
+    }
+    for (uint g = 0; g < n_touched; g++)
+      fprintf(out, "%u\t%s\t%lu\n", current, fmi.seq_names[touched[g]], hits[touched[g]]);
+
+    fclose(out);
+    free(hits);
+    free(touched);
+  }
+
+  for (uint t = 0; t < nthreads; t++)
+  {
+    if (buffers[t] != NULL)
+    {
+      fwrite(buffers[t], sizeof(char), buffers_len[t], fp);
+      free(buffers[t]);
+    }
+  }
+  free(buffers);
+  free(buffers_len);
+  return located;
+}
+
+// enables the unique-interval shortcut for the loaded index: it pays off
+// when the rest of the sequence needs more LF steps than a locate walk
+static void
+init_unique()
+{
+  if (!unique_mode) return;
+  if ((fmi.sa_rate == 0) || (fmi.n_packed == 0))
+  {
+    printf("ERROR: fm-index does not store suffix array samples and packed text (k2d64bv_build -s -p)\n");
+    exit(EXIT_FAILURE);
+  }
+  unique_min = fmi.sa_rate + KSTEPS;
+}
+
+// checks that the loaded index stores the Bloom filter of the prefilter (-F)
+static void
+init_filter()
+{
+  if (bloom_kmers && (fmi.n_bloom == 0))
+  {
+    printf("ERROR: fm-index does not store a Bloom filter of its k-mers (k2d64bv_build -b)\n");
+    exit(EXIT_FAILURE);
+  }
+}
+
+static void
+free_arenas(void)
+{
+  for (uint p = 0; p < narenas; p++) arena_free(&arenas[p]);
+  free(arenas);
+  arenas = NULL;
+  narenas = 0;
+}
+
+// hash of a sequence (FNV-1a)
+static inline uint64_t
+hash_sequence(const char *line, uint len)
+{
+  uint64_t h = 14695981039346656037UL;
+  for (uint i = 0; i < len; i++)
+    h = (h ^ (unsigned char) line[i])*1099511628211UL;
+  return h;
+}
+
+// collapses the duplicate reads (-D): the reads are hashed in parallel into an
+// open-addressing table filled with CAS, the first read stored in a slot
+// stands for the reads equal to it
+static void
+collapse_duplicates(char **lines, uint *lines_len, uint count)
+{
+  uint64_t size = 2, *hashes;
+  uint *table, *first;
+
+  while (size < 2*(uint64_t) count) size *= 2;
+  hashes = malloc(count*sizeof(uint64_t));
+  table = calloc(size, sizeof(uint));      // read + 1 of each slot, 0: empty
+  first = malloc(count*sizeof(uint));      // read standing for each read
+  dedup.read = malloc((count+1)*sizeof(uint));
+  if ((hashes == NULL) || (table == NULL) || (first == NULL) || (dedup.read == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+
+  omp_set_num_threads(nthreads);
+  #pragma omp parallel
+  {
+    #pragma omp for schedule(dynamic, 4096)
+    for (uint i = 0; i < count; i++)
+      hashes[i] = hash_sequence(lines[i], lines_len[i]);
+
+    #pragma omp for schedule(dynamic, 4096)
+    for (uint i = 0; i < count; i++)
+    {
+      uint64_t slot = hashes[i] & (size - 1);
+      while (1)
+      {
+        uint other = __atomic_load_n(&table[slot], __ATOMIC_ACQUIRE);
+        if ((other == 0) &&
+            __atomic_compare_exchange_n(&table[slot], &other, i + 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+        {
+          first[i] = i;
+          break;
+        }
+        other--;
+        if ((hashes[other] == hashes[i]) && (lines_len[other] == lines_len[i]) &&
+            (memcmp(lines[other], lines[i], lines_len[i]) == 0))
+        {
+          first[i] = other;
+          break;
+        }
+        slot = (slot + 1) & (size - 1);
+      }
+    }
+  } //#pragma omp parallel
+
+  // distinct sequences in the order of the reads
+  dedup.count = 0;
+  dedup.bases = 0;
+  for (uint i = 0; i < count; i++)
+    if (first[i] == i)
+    {
+      dedup.read[i] = dedup.count++;
+      dedup.bases += lines_len[i];
+    }
+  dedup.lines = malloc((dedup.count+1)*sizeof(char*));
+  dedup.lines_len = malloc((dedup.count+1)*sizeof(uint));
+  dedup.copies = calloc(dedup.count+1, sizeof(uint));
+  if ((dedup.lines == NULL) || (dedup.lines_len == NULL) || (dedup.copies == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  for (uint i = 0; i < count; i++)
+  {
+    uint d = dedup.read[first[i]];
+    dedup.read[i] = d;
+    dedup.lines[d] = lines[first[i]];
+    dedup.lines_len[d] = lines_len[first[i]];
+    dedup.copies[d]++;
+  }
+
+  free(hashes);
+  free(table);
+  free(first);
+}
+
+// occurrences of all the reads from the intervals of the distinct sequences (-D)
+static uint
+dedup_total(void)
+{
+  uint64_t total = 0;
+  for (uint d = 0; d < dedup.count; d++)
+    total += (uint64_t) dedup.copies[d]*(intervals[d].end - intervals[d].start);
+  return (uint) total;
+}
+
+// encodes the sequences into read_store (2 bits per symbol, see read_store)
+// with the encoding of the loaded index, in parallel; returns the offset of
+// each sequence
+static uint64_t *
+pack_reads(char **lines, uint *lines_len, uint count)
+{
+  uint64_t *offsets = malloc((count+1)*sizeof(uint64_t));
+  if (offsets == NULL)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  offsets[0] = 0;
+  for (uint i = 0; i < count; i++)
+    offsets[i+1] = offsets[i] + (lines_len[i] + 3)/4;
+
+  // 16-bit loads and 32-bit gathers may read past the last sequence
+  free(read_store);
+  read_store_bytes = offsets[count];
+  read_store = calloc(read_store_bytes + 4, sizeof(uint8_t));
+  if (read_store == NULL)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+
+  omp_set_num_threads(nthreads);
+  #pragma omp parallel for schedule(dynamic, 4096)
+  for (uint i = 0; i < count; i++)
+  {
+    uint8_t *packed = read_store + offsets[i];
+    for (uint j = 0; j < lines_len[i]; j++)
+    {
+      uint symbol = fmi.encoding_table[(uint8_t) lines[i][lines_len[i] - 1 - j]] & (SYMBOLS - 1);
+      packed[j/4] |= symbol << (BITS_PER_SYMBOL*(j % 4));
+    }
+  }
+  return offsets;
+}
+
+// waits for the worker processes, returns the number of failed workers
+static uint
+wait_workers(pid_t *pids, uint nworkers)
+{
+  uint failed = 0;
+
+  for (uint w = 0; w < nworkers; w++)
+  {
+    int status;
+    if ((waitpid(pids[w], &status, 0) < 0) || !WIFEXITED(status) || (WEXITSTATUS(status) != 0))
+    {
+      printf("ERROR: worker %u failed\n", w);
+      failed++;
+    }
+  }
+  return failed;
+}
+
+// reads a shards manifest (see k2d64bv_build -S)
+static uint
+read_manifest(const char *file, shard_t **parts, uint64_t *overlap)
+{
+  char *dir_tmp = strdup(file);
+  char *dir = dirname(dir_tmp);
+  char *linep = NULL;
+  char name[PATH_MAX];
+  size_t len = 0;
+  uint nparts = 0, nworkers = 0;
+  FILE *fp;
+
+  fp = fopen(file, "r");
+  if (fp == NULL)
+  {
+    printf("Error opening file %s\n", file);
+    exit(EXIT_FAILURE);
+  }
+
+  *parts = NULL;
+  *overlap = 0;
+  while (getline(&linep, &len, fp) != -1)
+  {
+    shard_t part;
+    if ((linep[0] == '#') || (linep[0] == '\n')) continue;
+    if (sscanf(linep, "overlap %lu", overlap) == 1) continue;
+    if ((sscanf(linep, "%d %4095s %lu %lu", &part.sign, name, &part.begin, &part.end) != 4) ||
+        ((part.sign != 1) && (part.sign != -1)) || ((part.sign == -1) && (nworkers == 0)))
+    {
+      printf("Error parsing shards manifest %s: %s", file, linep);
+      exit(EXIT_FAILURE);
+    }
+    // overlaps are searched by the worker of the previous shard
+    if (part.sign == 1) nworkers++;
+    part.worker = nworkers - 1;
+    // fm-index files are relative to the manifest
+    if (snprintf(part.file, sizeof(part.file), "%s/%s", dir, name) >= (int) sizeof(part.file))
+    {
+      printf("Error: path too long in shards manifest %s\n", file);
+      exit(EXIT_FAILURE);
+    }
+
+    *parts = realloc(*parts, (nparts+1)*sizeof(shard_t));
+    if (*parts == NULL)
+    {
+      printf("Error at malloc\n");
+      exit(EXIT_FAILURE);
+    }
+    (*parts)[nparts++] = part;
+  }
+  fclose(fp);
+  free(linep);
+  free(dir_tmp);
+  return nparts;
+}
+
+// searches the shards assigned to one worker, running in its own process
+static void
+shard_worker(shard_t *parts, uint nparts, uint worker, int node,
+             char **lines, uint *lines_len, uint count, int64_t *counts, worker_stats_t *stats)
+{
+  uint found;
+  double glfops, start_timer;
+
+  stats->node = (bind_to_node(node) > 0)? node : -1;
+  // threads pinned to the cpus of the node
+  if (bind_policy >= 0) bind_threads(0);
+  if (core_seqs > 0) plan_slots(0);
+  intervals = malloc((count+1)*sizeof(interval_t));
+  if (intervals == NULL)
+  {
+    printf("Error at malloc\n");
+    _exit(EXIT_FAILURE);
+  }
+
+  for (uint p = 0; p < nparts; p++)
+  {
+    if (parts[p].worker != worker) continue;
+
+    if (load_SFM(parts[p].file, &fmi) < 0) _exit(EXIT_FAILURE);
+    init_unique();
+    init_filter();
+    // encoded with the alphabet of the shard
+    free(read_offsets);
+    read_offsets = pack_reads(lines, lines_len, count);
+    if (kernel == NULL) kernel = calibrate(lines, lines_len, read_offsets, count, 0);
+
+    // the idle slots of the pool refer to the index: a pool per shard
+    if (pool.enabled) pool_start();
+    start_timer = omp_get_wtime();
+    stats->lf += search(lines, lines_len, read_offsets, count, &found, &glfops);
+    stats->time += omp_get_wtime() - start_timer;
+    if (pool.enabled)
+    {
+      pool_finish();
+      pool.stop = 0;
+    }
+
+    // occurrences inside an overlap are subtracted
+    stats->total += parts[p].sign*(int64_t) found;
+    for (uint i = 0; i < count; i++)
+      counts[i] += parts[p].sign*(int64_t)(intervals[i].end - intervals[i].start);
+    free_SFM(&fmi);
+  }
+  free(intervals);
+}
+
+// coordinator: one worker process per shard, each one bound to a NUMA node
+static void
+run_shards(const char *manifest, char **lines, uint *lines_len, uint count, const char *out_file)
+{
+  shard_t *parts;
+  uint64_t overlap;
+  uint nparts, nworkers = 0, max_len = 0;
+  int nodes = num_nodes();
+  double start_timer, end_timer;
+  int64_t total = 0;
+  uint64_t lf = 0;
+  pid_t *pids;
+
+  nparts = read_manifest(manifest, &parts, &overlap);
+  for (uint p = 0; p < nparts; p++)
+    if (parts[p].sign == 1) nworkers++;
+  for (uint i = 0; i < count; i++)
+    if (lines_len[i] > max_len) max_len = lines_len[i];
+
+  printf("Shards\n");
+  printf("- Manifest: %s\n", manifest);
+  printf("- Number of shards: %u (%u fm-indexes)\n", nworkers, nparts);
+  printf("- Overlap: %lu characters\n", overlap);
+  printf("- NUMA nodes: %d\n", nodes);
+  printf("- Number of threads per shard: %d\n", nthreads);
+  if (max_len > overlap + 1)
+    printf("WARNING: sequences longer than the overlap (%u): occurrences spanning two shards are missed\n", max_len);
+  printf(HLINE);
+  fflush(stdout);
+
+  // results are shared with the workers
+  size_t bytes = nworkers*(count*sizeof(int64_t) + sizeof(worker_stats_t));
+  int64_t *counts = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  pids = malloc(nworkers*sizeof(pid_t));
+  if ((counts == MAP_FAILED) || (pids == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  worker_stats_t *stats = (worker_stats_t*) (counts + (size_t) nworkers*count);
+
+  // fork before any OpenMP parallel region in this process
+  printf("Starting search... \n");
+  fflush(stdout);
+  start_timer = omp_get_wtime();
+  for (uint w = 0; w < nworkers; w++)
+  {
+    pids[w] = fork();
+    if (pids[w] == 0)
+    {
+      shard_worker(parts, nparts, w, w % nodes, lines, lines_len, count,
+                   counts + (size_t) w*count, &stats[w]);
+      fflush(stdout);
+      _exit(EXIT_SUCCESS);
+    }
+    if (pids[w] < 0)
+    {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (wait_workers(pids, nworkers) > 0) exit(EXIT_FAILURE);
+  end_timer = omp_get_wtime();
+  printf("OK\n");
+
+  for (uint w = 0; w < nworkers; w++)
+  {
+    printf("- shard %u: node %2d, %.3fs, %6.3f GLFOPS, %ld occurrences\n", w, stats[w].node,
+           stats[w].time, stats[w].lf/(GIGA*stats[w].time), stats[w].total);
+    total += stats[w].total;
+    lf += stats[w].lf;
+  }
+  printf("Occurrences found: %ld\n", total);
+  printf("Total LFOP: %.2fG\n", lf/GIGA);
+  printf("Total time: %f\n", end_timer - start_timer);
+  printf("Raw throughput: %6.3f GLFOPS\n", lf/(end_timer - start_timer)/GIGA);
+  printf(HLINE);
+
+  if (out_file != 0)
+  {
+    FILE *fp = fopen(out_file, "w");
+    if (fp == NULL)
+    {
+      printf("Error opening file %s\n", out_file);
+      exit(EXIT_FAILURE);
+    }
+    for (uint i = 0; i < count; i++)
+    {
+      int64_t read_total = 0;
+      for (uint w = 0; w < nworkers; w++)
+        read_total += counts[(size_t) w*count + i];
+      fprintf(fp, "%u\t%ld\n", i, read_total);
+    }
+    fclose(fp);
+    printf("Per-read occurrences written to file %s\n", out_file);
+    printf(HLINE);
+  }
+
+  munmap(counts, bytes);
+  free(pids);
+  free(parts);
+}
+
+// searches the sequences of one part of the sequence file, running in its own process
+static void
+rank_worker(const char *fmi_file, const char *seq_file, long begin, long end, int node,
+            FILE *results, worker_stats_t *stats)
+{
+  char **lines;
+  uint *lines_len, found;
+  uint64_t bases, bytes;
+  double glfops, start_timer;
+
+  stats->node = (bind_to_node(node) > 0)? node : -1;
+  // threads pinned to the cpus of the node
+  if (bind_policy >= 0) bind_threads(0);
+  if (core_seqs > 0) plan_slots(0);
+  // the index and the sequences are allocated after binding (local memory)
+  free_arenas();
+  stats->count = load_sequences(seq_file, begin, end, nthreads, &arenas, &narenas, &lines, &lines_len, &bases, &bytes);
+  if (load_SFM(fmi_file, &fmi) < 0) _exit(EXIT_FAILURE);
+  init_unique();
+  init_filter();
+  read_offsets = pack_reads(lines, lines_len, stats->count);
+  if (kernel == NULL) kernel = calibrate(lines, lines_len, read_offsets, stats->count, 0);
+
+  if (results != NULL)
+  {
+    intervals = malloc((stats->count+1)*sizeof(interval_t));
+    if (intervals == NULL)
+    {
+      printf("Error at malloc\n");
+      _exit(EXIT_FAILURE);
+    }
+  }
+
+  if (pool.enabled) pool_start();
+  start_timer = omp_get_wtime();
+  stats->lf = search(lines, lines_len, read_offsets, stats->count, &found, &glfops);
+  stats->time = omp_get_wtime() - start_timer;
+  if (pool.enabled) pool_finish();
+  stats->total = found;
+
+  if (results != NULL)
+  {
+    for (uint i = 0; i < stats->count; i++)
+    {
+      uint64_t occ = intervals[i].end - intervals[i].start;
+      fwrite(&occ, sizeof(uint64_t), 1, results);
+    }
+    if (fflush(results) != 0) _exit(EXIT_FAILURE);
+  }
+}
+
+// coordinator: the sequence file is split in nranks byte ranges, each one searched
+// by a process bound to a NUMA node (round robin) with its own copy of the index
+static void
+run_ranks(const char *fmi_file, const char *seq_file, uint nranks, const char *out_file)
+{
+  int nodes = num_nodes();
+  double start_timer, end_timer;
+  uint64_t lf = 0, total = 0;
+  uint count = 0;
+  struct stat st;
+  FILE **results;
+  pid_t *pids;
+
+  if (stat(seq_file, &st) < 0)
+  {
+    printf("Error opening file %s\n", seq_file);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Ranks\n");
+  printf("- FM-index file: %s\n", fmi_file);
+  printf("- Sequence file: %s (%.1fMiB)\n", seq_file, (double) st.st_size/MiB);
+  printf("- Number of ranks: %u\n", nranks);
+  printf("- NUMA nodes: %d\n", nodes);
+  printf("- Number of threads per rank: %d\n", nthreads);
+  printf(HLINE);
+
+  // stats are shared with the workers, per-read results are returned in temporary files
+  size_t bytes = nranks*sizeof(worker_stats_t);
+  worker_stats_t *stats = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  pids = malloc(nranks*sizeof(pid_t));
+  results = calloc(nranks, sizeof(FILE*));
+  if ((stats == MAP_FAILED) || (pids == NULL) || (results == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  for (uint r = 0; (out_file != 0) && (r < nranks); r++)
+  {
+    if ((results[r] = tmpfile()) == NULL)
+    {
+      perror("tmpfile");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  // fork before any OpenMP parallel region in this process
+  printf("Starting search... \n");
+  fflush(stdout);
+  start_timer = omp_get_wtime();
+  for (uint r = 0; r < nranks; r++)
+  {
+    pids[r] = fork();
+    if (pids[r] == 0)
+    {
+      long begin = (long) (st.st_size*r/nranks);
+      long end = (long) (st.st_size*(r+1)/nranks);
+      rank_worker(fmi_file, seq_file, begin, end, r % nodes, results[r], &stats[r]);
+      fflush(stdout);
+      _exit(EXIT_SUCCESS);
+    }
+    if (pids[r] < 0)
+    {
+      perror("fork");
+      exit(EXIT_FAILURE);
+    }
+  }
+  if (wait_workers(pids, nranks) > 0) exit(EXIT_FAILURE);
+  end_timer = omp_get_wtime();
+  printf("OK\n");
+
+  for (uint r = 0; r < nranks; r++)
+  {
+    printf("- rank %u: node %2d, %u sequences, %.3fs, %6.3f GLFOPS, %ld occurrences\n", r, stats[r].node,
+           stats[r].count, stats[r].time, stats[r].lf/(GIGA*stats[r].time), stats[r].total);
+    count += stats[r].count;
+    total += stats[r].total;
+    lf += stats[r].lf;
+  }
+  printf("Number of sequences: %.2f Mseq (%u)\n", count/MEGA, count);
+  printf("Occurrences found: %lu\n", total);
+  printf("Total LFOP: %.2fG\n", lf/GIGA);
+  printf("Total time: %f\n", end_timer - start_timer);
+  printf("Raw throughput: %6.3f GLFOPS\n", lf/(end_timer - start_timer)/GIGA);
+  printf(HLINE);
+
+  if (out_file != 0)
+  {
+    FILE *fp = fopen(out_file, "w");
+    uint64_t occ;
+    uint i = 0;
+
+    if (fp == NULL)
+    {
+      printf("Error opening file %s\n", out_file);
+      exit(EXIT_FAILURE);
+    }
+    // reads are numbered in the order of the sequence file
+    for (uint r = 0; r < nranks; r++)
+    {
+      rewind(results[r]);
+      while (fread(&occ, sizeof(uint64_t), 1, results[r]) == 1)
+        fprintf(fp, "%u\t%lu\n", i++, occ);
+      fclose(results[r]);
+    }
+    fclose(fp);
+    printf("Per-read occurrences written to file %s\n", out_file);
+    printf(HLINE);
+  }
+
+  munmap(stats, bytes);
+  free(results);
+  free(pids);
+}
+
+// allocates the hot k-mer cache (-C), empty
+static void
+init_cache(void)
+{
+  hot_cache.size = (uint64_t)(cache_mib*MiB)/sizeof(cache_entry_t);
+  hot_cache.entries = aligned_alloc(BYTES_PER_CACHE_BLOCK,
+                                    ((hot_cache.size*sizeof(cache_entry_t) + BYTES_PER_CACHE_BLOCK - 1)/
+                                     BYTES_PER_CACHE_BLOCK)*BYTES_PER_CACHE_BLOCK);
+  if ((hot_cache.size == 0) || (hot_cache.entries == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  memset(hot_cache.entries, 0, hot_cache.size*sizeof(cache_entry_t));
+}
+
+// first stage: parses the input into the free slots of the ring, a batch of
+// stream_seqs sequences at a time; only complete lines are parsed, and a
+// record cut at the end of the buffer waits for more input
+static void *
+stream_parser(void *arg)
+{
+  uint64_t size = STREAM_BUFFER, len, pos = 0, consumed = 0, lines_end;
+  char *buf = malloc(size);
+  int eof, fastq;
+
+  (void) arg;
+  if (buf == NULL)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  len = seq_stream_read(&stream.input, buf, size);
+  if ((len > 0) && (buf[0] != '>') && (buf[0] != '@'))
+  {
+    printf("ERROR: %s is not a FASTA or FASTQ file\n\n", stream.input.name);
+    exit(1);
+  }
+  fastq = (len > 0) && (buf[0] == '@');
+  eof = (len == 0);
+  for (lines_end = len; !eof && (lines_end > 0) && (buf[lines_end-1] != '\n'); lines_end--);
+
+  while (!eof || (pos < len))
+  {
+    stream_batch_t *batch;
+    double start_timer;
+
+    pthread_mutex_lock(&stream.lock);
+    while (stream.parsed - stream.written >= STREAM_SLOTS)
+      pthread_cond_wait(&stream.changed, &stream.lock);
+    batch = &stream.ring[stream.parsed % STREAM_SLOTS];
+    pthread_mutex_unlock(&stream.lock);
+
+    start_timer = omp_get_wtime();
+    batch->arena.bytes = 0;
+    batch->arena.count = 0;
+    while (batch->arena.count < stream_seqs)
+    {
+      const char *next = NULL;
+      if (pos < lines_end)
+        next = parse_record(buf + pos, buf + lines_end, !eof, fastq, stream.input.name, consumed + pos, &batch->arena);
+      if (next != NULL)
+      {
+        pos = next - buf;
+        continue;
+      }
+      if (eof) break;
+
+      // keeps the unparsed bytes and reads more input
+      memmove(buf, buf + pos, len - pos);
+      consumed += pos;
+      len -= pos;
+      lines_end = pos = 0;
+      if (len == size)
+      {
+        size *= 2;
+        buf = realloc(buf, size);
+        if (buf == NULL)
+        {
+          printf("Error at malloc\n");
+          exit(EXIT_FAILURE);
+        }
+      }
+      uint64_t got = seq_stream_read(&stream.input, buf + len, size - len);
+      len += got;
+      eof = (got == 0);
+      // only complete lines are parsed until the end of the input
+      for (lines_end = len; !eof && (lines_end > 0) && (buf[lines_end-1] != '\n'); lines_end--);
+    }
+    for (uint i = 0; i < batch->arena.count; i++)
+      batch->lines[i] = batch->arena.text + batch->arena.starts[i];
+    batch->first = stream.reads;
+    batch->count = batch->arena.count;
+    stream.reads += batch->count;
+    stream.bases += batch->arena.bytes - batch->arena.count;
+    stream.parse_time += omp_get_wtime() - start_timer;
+
+    pthread_mutex_lock(&stream.lock);
+    if (batch->count > 0) stream.parsed++;
+    pthread_cond_broadcast(&stream.changed);
+    pthread_mutex_unlock(&stream.lock);
+  }
+  stream.bytes = consumed + pos;
+  free(buf);
+
+  pthread_mutex_lock(&stream.lock);
+  stream.done = 1;
+  pthread_cond_broadcast(&stream.changed);
+  pthread_mutex_unlock(&stream.lock);
+  return NULL;
+}
+
+// last stage: writes the occurrences of the searched batches, in order
+static void *
+stream_output(void *arg)
+{
+  (void) arg;
+  for (;;)
+  {
+    stream_batch_t *batch;
+    double start_timer;
+
+    pthread_mutex_lock(&stream.lock);
+    while ((stream.written == stream.searched) && !(stream.done && (stream.written == stream.parsed)))
+      pthread_cond_wait(&stream.changed, &stream.lock);
+    if (stream.written == stream.searched)
+    {
+      pthread_mutex_unlock(&stream.lock);
+      break;
+    }
+    batch = &stream.ring[stream.written % STREAM_SLOTS];
+    pthread_mutex_unlock(&stream.lock);
+
+    start_timer = omp_get_wtime();
+    if (stream.out != NULL)
+      for (uint i = 0; i < batch->count; i++)
+        fprintf(stream.out, "%lu\t%lu\n", batch->first + i,
+                batch->intervals[i].end - batch->intervals[i].start);
+    stream.output_time += omp_get_wtime() - start_timer;
+
+    pthread_mutex_lock(&stream.lock);
+    stream.written++;
+    pthread_cond_broadcast(&stream.changed);
+    pthread_mutex_unlock(&stream.lock);
+  }
+  return NULL;
+}
+
+// streaming mode: the main thread searches the batches filled by the parser
+// thread, while the output thread writes the previous ones; the memory is that
+// of the STREAM_SLOTS batches whatever the size of the input
+static void
+run_stream(const char *fmi_file, const char *seq_file, const char *out_file)
+{
+  pthread_t parser, output;
+  double start_timer, end_timer, search_time = 0.0, glfops;
+  uint64_t lf = 0, total = 0, skipped = 0, arena_bytes = 0;
+  uint batches = 0, found;
 
-  #pragma omp parallel reduction(+:total, lf, lfops) shared(fmi, lines)
+  seq_stream_open(&stream.input, seq_file, nthreads);
+  if (out_file != 0)
   {
-    uint64_t start[NSEQS], end[NSEQS];
-    SFM_entry_t *start_bl[NSEQS], *end_bl[NSEQS];
-    uint8_t next_symbol[NSEQS];
-    int index[NSEQS];
-    uint line_index[NSEQS], lengths[NSEQS], finished_seqs = 0;
-    char * working_lines[NSEQS];
-    double start_time, end_time;
-    // char seq_tmp[32] = {0};
-
-    // Divide the sequences into blocks, one for each thread
-    uint thread_id = omp_get_thread_num();
-    uint bl_offset = thread_id*th_bl_size;
-    uint block_len  = th_bl_size;
-    if (thread_id < count % nthreads)
+    stream.out = fopen(out_file, "w");
+    if (stream.out == NULL)
     {
-      block_len++;
-      bl_offset += thread_id;
+      printf("Error opening file %s\n", out_file);
+      exit(EXIT_FAILURE);
     }
-    else
-      bl_offset += count % nthreads;
-
-#if DEBUG_THREADS
-    uint32_t cpu_num, node_num;
-    int status;
-    status = syscall(SYS_getcpu, &cpu_num, &node_num, NULL);
-    if  (status != -1)
+  }
+  for (uint b = 0; b < STREAM_SLOTS; b++)
+  {
+    stream.ring[b].lines = malloc((stream_seqs+1)*sizeof(char*));
+    stream.ring[b].intervals = malloc((stream_seqs+1)*sizeof(interval_t));
+    if ((stream.ring[b].lines == NULL) || (stream.ring[b].intervals == NULL))
     {
-        // int cpu_num = sched_getcpu();
-        printf("  th.%2u -> core %2u -> node %u: %9u->%9u\n",
-                thread_id, cpu_num, node_num, bl_offset, bl_offset + block_len - 1);
+      printf("Error at malloc\n");
+      exit(EXIT_FAILURE);
     }
-#endif
-
-    char ** lines_block = lines + bl_offset;
-
-    start_time = omp_get_wtime();
+  }
 
-    // Get starting positions for the sequences (LUT)
-    for(uint j=0; j < NSEQS; j++)
-    {
-        uint lut_index = 0, lut_index_len = 0, shift_bits = 0;
-        working_lines[j] = lines_block[j];
-        lengths[j] = lines_len[bl_offset + j];
-        line_index[j] = bl_offset + j;
-        lut_index_len = 6 - (lengths[j] % 2);
-        for (uint i = lengths[j] - 1; i > lengths[j] - 1 - lut_index_len; i--)
-        {
-            lut_index += (uint)(fmi.encoding_table[(uint)working_lines[j][i]]) << shift_bits;
-            shift_bits += BITS_PER_SYMBOL;
-        }
-        // update stats
-        lf += lut_index_len*2;
-        start[j] = fmi.LUT[lengths[j] % KSTEPS][lut_index].start;
-        end[j]   = fmi.LUT[lengths[j] % KSTEPS][lut_index].end + 1;
+  if (cache_mib > 0) init_cache();
+  if (bind_policy >= 0)
+  {
+    bind_threads(1);
+    fflush(stdout);
+  }
+  if (core_seqs > 0)
+  {
+    plan_slots(1);
+    fflush(stdout);
+  }
 
-        index[j] = lengths[j] - KSTEPS - lut_index_len;
-        // Encode *two* chars for the starting pairs (uint16_t)
-        next_symbol[j] = fmi.encoding_table2[*((uint16_t*)(working_lines[j] + index[j]))];
-        index[j] -= KSTEPS;
+  printf("Parameters\n");
+  printf("- FM-index file: %s\n", fmi_file);
+  printf("- Index size: %.1fGiB (%lu characters)\n", (double)(fmi.len)/GiB, fmi.len);
+  printf("- Number of threads: %d\n", nthreads);
+  if (engine_bfs)
+    printf("- Engine: breadth-first%s, %u sequences per thread and round\n",
+           engine_trie? ", shared-suffix trie" : "", bfs_seqs);
+  else if (kernel != NULL)
+    print_kernel(kernel);
+  printf("- Sequence file: %s\n", (stream.input.fd == STDIN_FILENO)? "standard input" : seq_file);
+  printf("- Streaming: batches of %u sequences, ring of %u batches (parse, search, output)\n",
+         stream_seqs, STREAM_SLOTS);
+  printf(HLINE);
+  fflush(stdout);
 
-#if 0
-        printf("\nseq %u: %s\n", line_index[j], working_lines[j]);
-        decode_symbols(lut_index, seq_tmp, fmi.alphabet, BITS_PER_SYMBOL, lut_index_len);
-        printf("  LUT_index = %u = %s ->", lut_index, seq_tmp);
-        printf("  start/end[%d] = %lu/%lu (LUT)\n", j, start[j], end[j]);
-        printf("  index[%2u] = %2d/%2d ->", j, index[j] + KSTEPS, lengths[j] - 1);
-        decode_symbols(next_symbol[j], seq_tmp, fmi.alphabet, BITS_PER_SYMBOL, KSTEPS);
-        printf("  next_symbol[%2d] = %2u = %s ->", j, next_symbol[j], seq_tmp);
-        fflush(stdout);
-#endif
+  if (pool.enabled) pool_start();
+  printf("Starting search... \n");
+  fflush(stdout);
+  start_timer = omp_get_wtime();
+  if (pthread_create(&parser, NULL, stream_parser, NULL) != 0 ||
+      pthread_create(&output, NULL, stream_output, NULL) != 0)
+  {
+    printf("Error creating the threads of the stream\n");
+    exit(EXIT_FAILURE);
+  }
 
-        // Get starting blocks to search
-        start_bl[j] = &fmi.entries[(start[j]/D_VAL)*K2_SYMBOLS + next_symbol[j]];
-        end_bl[j]   = &fmi.entries[(  end[j]/D_VAL)*K2_SYMBOLS + next_symbol[j]];
+  for (;;)
+  {
+    stream_batch_t *batch;
+    double search_start;
 
-        // Prefetch blocks for next execution of sequence j into L2
-        _mm_prefetch((char*) start_bl[j], PREFETCH_HINT_L2);
-        _mm_prefetch((char*) end_bl[j],   PREFETCH_HINT_L2);
+    pthread_mutex_lock(&stream.lock);
+    while ((stream.searched == stream.parsed) && !stream.done)
+      pthread_cond_wait(&stream.changed, &stream.lock);
+    if (stream.searched == stream.parsed)
+    {
+      pthread_mutex_unlock(&stream.lock);
+      break;
     }
+    batch = &stream.ring[stream.searched % STREAM_SLOTS];
+    pthread_mutex_unlock(&stream.lock);
 
-    while(finished_seqs < block_len)
+    search_start = omp_get_wtime();
+    free(read_offsets);
+    read_offsets = pack_reads(batch->lines, batch->arena.lens, batch->count);
+    if (kernel == NULL)
     {
-        /* start of loop to analyze */
-        IACA_START
+      kernel = calibrate(batch->lines, batch->arena.lens, read_offsets, batch->count, 1);
+      fflush(stdout);
+    }
+    intervals = (stream.out != NULL)? batch->intervals : NULL;
+    lf += search(batch->lines, batch->arena.lens, read_offsets, batch->count, &found, &glfops);
+    total += found;
+    skipped += empty_skipped;
+    search_time += omp_get_wtime() - search_start;
+    batches++;
+
+    pthread_mutex_lock(&stream.lock);
+    stream.searched++;
+    pthread_cond_broadcast(&stream.changed);
+    pthread_mutex_unlock(&stream.lock);
+  }
+  pthread_join(parser, NULL);
+  pthread_join(output, NULL);
+  end_timer = omp_get_wtime();
+  if (pool.enabled) pool_finish();
+  intervals = NULL;
+  printf("OK\n");
 
-        for (uint j=0; j < NSEQS; j++)
-        {
-            // Prefetch blocks for sequence j into L1
-            #ifdef DUAL_PREFETCH
-              _mm_prefetch((char*) start_bl[j], PREFETCH_HINT_L1);
-              _mm_prefetch((char*) end_bl[j],   PREFETCH_HINT_L1);
-            #endif
-
-            // LFs for sequence j
-            start[j] = k2_LF(start[j], start_bl[j]);
-            end[j]   = k2_LF(end[j]  , end_bl[j]);
-
-            // printf("  start/end[%2u] = %2lu/%2lu\n", j, start[j], end[j]);
-        
-            // Check if finished sequence j
-            _CHECK_FINISHED_SEQ(j);
-            _ENCODE_CHARS(j);
+  for (uint b = 0; b < STREAM_SLOTS; b++)
+    arena_bytes += stream.ring[b].arena.size;
+  printf("Number of sequences: %.2f Mseq (%lu), %.2f Gbases, %u batches\n",
+         stream.reads/MEGA, stream.reads, stream.bases/GIGA, batches);
+  printf("Occurrences found: %lu\n", total);
+  printf("Total LFOP: %.2fG (expected %.2fG, %.2fG skipped on empty intervals)\n",
+         lf/GIGA, 2*stream.bases/GIGA, skipped/GIGA);
+  printf("Total time: %f\n", end_timer - start_timer);
+  printf("Raw throughput: %6.3f GLFOPS\n", lf/(end_timer - start_timer)/GIGA);
+  printf("Stages: parse %fs (%.1f MB/s), search %fs, output %fs; overlap %.2fx\n",
+         stream.parse_time, (stream.parse_time > 0)? stream.bytes/(MEGA*stream.parse_time) : 0.0,
+         search_time, stream.output_time,
+         (stream.parse_time + search_time + stream.output_time)/(end_timer - start_timer));
+  printf("Ring: %.1fMiB of sequences in %u batches\n", (double) arena_bytes/MiB, STREAM_SLOTS);
+  printf(HLINE);
 
-#if 0
-            printf("  index[%2u] = %2d/%2d ->", j, index[j] + KSTEPS, lengths[j] - 1);
-            decode_symbols(next_symbol[j], seq_tmp, fmi.alphabet, BITS_PER_SYMBOL, KSTEPS);
-            printf("  next_symbol[%2d] = %2u = %s ->", j, next_symbol[j], seq_tmp);
-            fflush(stdout);
-#endif
+  if (stream.out != NULL)
+  {
+    fclose(stream.out);
+    printf("Per-read occurrences written to file %s\n", out_file);
+    printf(HLINE);
+  }
+  seq_stream_close(&stream.input);
+  for (uint b = 0; b < STREAM_SLOTS; b++)
+  {
+    arena_free(&stream.ring[b].arena);
+    free(stream.ring[b].lines);
+    free(stream.ring[b].intervals);
+  }
+  free(hot_cache.entries);
+  free(read_store);
+  free(read_offsets);
+}
 
-            // Calculate blocks for sequence j
-            start_bl[j] = &fmi.entries[(start[j]/D_VAL)*K2_SYMBOLS + next_symbol[j]];
-            end_bl[j]   = &fmi.entries[(end[j]/D_VAL)*K2_SYMBOLS   + next_symbol[j]];
+// busy and idle time of the threads in the last search (team) or share of
+// the LF steps of each thread (pool)
+static void
+balance(void)
+{
+    double first = DBL_MAX, last = 0.0;
+    double busy_min = DBL_MAX, busy_max = 0.0, busy_sum = 0.0;
 
-            // Prefetch blocks for next execution of sequence j into L2
-            _mm_prefetch((char*) start_bl[j], PREFETCH_HINT_L2);
-            _mm_prefetch((char*) end_bl[j],   PREFETCH_HINT_L2);
-            ////////////////////////////////////////////////////////////////////
+    if (pool.enabled)
+    {
+        uint64_t lf_min = UINT64_MAX, lf_max = 0, lf_sum = 0;
+        for (uint t = 0; t < nthreads; t++)
+        {
+            uint64_t lf = thread_stats[t].lf;
+            if (lf < lf_min) lf_min = lf;
+            if (lf > lf_max) lf_max = lf;
+            lf_sum += lf;
         }
-        // update stats
-        lf += 2*KSTEPS*NSEQS;
+        printf("Load balance (all runs, thread pool, chunks of %u sequences)\n", chunk_size);
+        printf("- LF steps per thread: %.2fG min, %.2fG avg, %.2fG max\n",
+               lf_min/GIGA, lf_sum/(GIGA*nthreads), lf_max/GIGA);
+        return;
     }
 
-    end_time = omp_get_wtime();
-    lfops = lf/(end_time - start_time);
-
-    /* end of loop to analyze */
-    IACA_END
-
-    #pragma omp barrier
-
-  } //#pragma omp parallel
-
-  (*found) = total;
-  (*glfops) = lfops/GIGA;
-  return lf;
+    for (uint t = 0; t < nthreads; t++)
+    {
+        double busy = thread_stats[t].end - thread_stats[t].start;
+        if (thread_stats[t].start < first) first = thread_stats[t].start;
+        if (thread_stats[t].end > last) last = thread_stats[t].end;
+        if (busy < busy_min) busy_min = busy;
+        if (busy > busy_max) busy_max = busy;
+        busy_sum += busy;
+    }
+    if (chunk_size > 0)
+        printf("Load balance (last batch, chunks of %u sequences)\n", chunk_size);
+    else
+        printf("Load balance (last batch, static split)\n");
+    printf("- Busy time per thread: %.4fs min, %.4fs avg, %.4fs max\n",
+           busy_min, busy_sum/nthreads, busy_max);
+    printf("- Idle time: %.4fs per thread (%.1f%%)\n", (nthreads*(last - first) - busy_sum)/nthreads,
+           100.0*(1.0 - busy_sum/(nthreads*(last - first))));
 }
 
+// lf: LF steps performed by each run; cached: steps saved by the hot k-mer
+// cache (-C), which depend on the order the threads fill it, so that only
+// their sum is the same in every run
 static void
-metrics(double *sample, uint64_t *lf, double *sample_glfops, int nruns)
+metrics(double *sample, uint64_t *lf, uint64_t *cached, double *sample_glfops, int nruns)
 {
     // Compute results
     double time_min = FLT_MAX, time_max = 0;
     double glfops_min = FLT_MAX, glfops_max = 0;
     double time_sum = 0, time_deviation_sum = 0, time_avg, time_deviation;
-    uint32_t time_min_idx, time_max_idx;
+    uint32_t time_min_idx = 1, time_max_idx = 1;
     double glfops_sum = 0.0, glfops_avg;
-    double GLF = lf[0]/GIGA;
+    double GLF = 0.0;
 
-    if (!elements_64b_equal(lf, nruns))
+    for (int i = 0; i < nruns; i++)
     {
-        printf("ERROR: different runs performed different number of LFOPS\n");
-        return;
+        if (lf[i] + cached[i] != lf[0] + cached[0])
+        {
+            printf("ERROR: different runs performed different number of LFOPS\n");
+            return;
+        }
     }
 
     for (int i = 1; i < nruns; i++)
     {
+        GLF += lf[i]/GIGA/(nruns - 1);
         time_sum += sample[i];
         if (sample[i] < time_min)
         {
@@ -409,12 +2698,12 @@ metrics(double *sample, uint64_t *lf, double *sample_glfops, int nruns)
     time_deviation = sqrt(time_deviation_sum / (nruns-1));
 
     // Show metrics
-    printf("Best throughput: %6.3f GLFOPS (%.3f)\n", GLF/time_min, glfops_max);
+    printf("Best throughput: %6.3f GLFOPS (%.3f)\n", lf[time_min_idx]/GIGA/time_min, glfops_max);
     printf("Avg. throughput: %6.3f GLFOPS (%.3f)\n", GLF/time_avg, glfops_avg);
-    printf("Throughputs: [%.3f]", GLF/sample[0]);
+    printf("Throughputs: [%.3f]", lf[0]/GIGA/sample[0]);
     for (int i = 1; i < nruns; i++)
     {
-        printf(" %.3f", GLF/sample[i]);
+        printf(" %.3f", lf[i]/GIGA/sample[i]);
     }
     printf("\n");    
     printf("Min time: %6.3f s (run #%u)\n", time_min, time_min_idx);
@@ -436,18 +2725,25 @@ metrics(double *sample, uint64_t *lf, double *sample_glfops, int nruns)
 int
 main(int argc, char *argv[])
 {
-  uint total[MAXRUNS], count = 0, lines_size = 1000;
+  uint total[MAXRUNS], count = 0;
   int nruns = DEFAULT_RUNS;
   FILE * fp;
   char ** lines;
   uint * lines_len;
-  ssize_t read;
+  char **search_lines;            // sequences searched (-D: the distinct ones)
+  uint *search_lens, search_count;
   double start_timer, end_timer, sample[MAXRUNS];
   double start0, end0;
   double sample_glfops[MAXRUNS];
-  uint64_t bases = 0, lf[MAXRUNS] = { 0 };
+  uint64_t bases = 0, bytes = 0, lf[MAXRUNS] = { 0 }, lf_cached[MAXRUNS] = { 0 };
   char *fmi_file = 0;
+  char *manifest_file = 0;
   char *seq_file = 0;
+  char *out_file = 0;
+  char *isa_name = 0;
+  int docs = 0, dual = DEFAULT_DUAL;
+  uint nranks = 0, nseqs = NSEQS;
+  char prefetch[3] = "";
   int n = 0, option = 0;
 
   printf("Program version: 20190206\n");
@@ -464,6 +2760,19 @@ main(int argc, char *argv[])
               fmi_file = optarg;
               break;
 
+          case 'm':
+              manifest_file = optarg;
+              break;
+
+          case 'p':
+              n = sscanf(optarg, "%u", &nranks);
+              if ((n != 1) || (nranks < 1))
+              {
+                  printf("ERROR: wrong number of ranks\n\n");
+                  exit(1);
+              }
+              break;
+
           case 's':
               seq_file = optarg;
               break;
@@ -487,6 +2796,167 @@ main(int argc, char *argv[])
               }
               break;
 
+          case 'o':
+              out_file = optarg;
+              break;
+
+          case 'k':
+              if (strcmp(optarg, "scalar") == 0)
+                  kernel_kind = 0;
+              else if (strcmp(optarg, "vector") == 0)
+                  kernel_kind = 1;
+              else
+              {
+                  printf("ERROR: unknown kernel %s\n\n", optarg);
+                  exit(1);
+              }
+              break;
+
+          case 'n':
+              if (strcmp(optarg, "auto") == 0)
+              {
+                  nseqs_auto = 1;
+                  core_seqs = 0;
+                  break;
+              }
+              nseqs_auto = 0;
+              core_seqs = 0;
+              if (strncmp(optarg, "core", 4) == 0)
+              {
+                  core_seqs = CORE_SEQS;
+                  if (optarg[4] == 0) break;
+                  n = (optarg[4] == ':')? sscanf(optarg + 5, "%u%2s", &core_seqs, prefetch) : 0;
+                  if ((n < 1) || (core_seqs < 1))
+                  {
+                      printf("ERROR: wrong number of overlapped sequences per core\n\n");
+                      exit(1);
+                  }
+              }
+              else
+              {
+                  n = sscanf(optarg, "%u%2s", &nseqs, prefetch);
+                  if ((n < 1) || (nseqs < 1))
+                  {
+                      printf("ERROR: wrong number of overlapped sequences\n\n");
+                      exit(1);
+                  }
+              }
+              if (n == 2)
+              {
+                  if (strcmp(prefetch, "sp") == 0)
+                      dual = 0;
+                  else if (strcmp(prefetch, "dp") == 0)
+                      dual = 1;
+                  else
+                  {
+                      printf("ERROR: unknown prefetch type %s (sp or dp)\n\n", prefetch);
+                      exit(1);
+                  }
+              }
+              break;
+
+          case 'i':
+              isa_name = optarg;
+              break;
+
+          case 'c':
+              n = sscanf(optarg, "%u", &chunk_size);
+              if (n != 1)
+              {
+                  printf("ERROR: wrong chunk size\n\n");
+                  exit(1);
+              }
+              break;
+
+          case 'b':
+              n = sscanf(optarg, "%u", &batch_size);
+              if (n != 1)
+              {
+                  printf("ERROR: wrong batch size\n\n");
+                  exit(1);
+              }
+              break;
+
+          case 'P':
+              pool.enabled = 1;
+              break;
+
+          case 'S':
+              share_slots = 1;
+              break;
+
+          case 'e':
+              if (strcmp(optarg, "interleaved") == 0)
+                  engine_bfs = 0;
+              else if ((strncmp(optarg, "bfs", 3) == 0) || (strncmp(optarg, "trie", 4) == 0))
+              {
+                  engine_bfs = 1;
+                  engine_trie = (optarg[0] == 't');
+                  optarg += engine_trie;
+                  if ((optarg[3] != 0) &&
+                      ((optarg[3] != ':') || (sscanf(optarg + 4, "%u", &bfs_seqs) != 1) || (bfs_seqs < 1)))
+                  {
+                      printf("ERROR: wrong number of sequences of the breadth-first engine\n\n");
+                      exit(1);
+                  }
+              }
+              else
+              {
+                  printf("ERROR: unknown engine %s\n\n", optarg);
+                  exit(1);
+              }
+              break;
+
+          case 'B':
+              for (bind_policy = 0; bind_names[bind_policy] != NULL; bind_policy++)
+                  if (strcmp(optarg, bind_names[bind_policy]) == 0) break;
+              if (bind_names[bind_policy] == NULL)
+              {
+                  printf("ERROR: unknown binding policy %s\n\n", optarg);
+                  exit(1);
+              }
+              break;
+
+          case 'd':
+              docs = 1;
+              break;
+
+          case 'D':
+              dedup.enabled = 1;
+              break;
+
+          case 'F':
+              n = sscanf(optarg, "%u", &bloom_kmers);
+              if ((n != 1) || (bloom_kmers < 1))
+              {
+                  printf("ERROR: wrong number of k-mers of the Bloom prefilter\n\n");
+                  exit(1);
+              }
+              break;
+
+          case 'C':
+              n = sscanf(optarg, "%lf:%u", &cache_mib, &hot_cache.depth);
+              if ((n < 1) || (cache_mib <= 0) ||
+                  (hot_cache.depth < CACHE_MIN_DEPTH) || (hot_cache.depth > CACHE_MAX_DEPTH))
+              {
+                  printf("ERROR: wrong size or depth of the hot k-mer cache\n\n");
+                  exit(1);
+              }
+              break;
+
+          case 'u':
+              unique_mode = 1;
+              break;
+
+          case 'q':
+              n = sscanf(optarg, "%u", &stream_seqs);
+              if ((n != 1) || (stream_seqs < 1))
+              {
+                  printf("ERROR: wrong number of sequences per batch of the stream\n\n");
+                  exit(1);
+              }
+              break;
+
           case 'h':
               show_usage(argv[0], 0);
               break;
@@ -497,16 +2967,95 @@ main(int argc, char *argv[])
   }
 
   /* check arguments */
-  if (fmi_file == 0)
+  if ((fmi_file == 0) && (manifest_file == 0))
   {
       printf("ERROR: fm-index file not specified\n");
       show_usage(argv[0], 1);
   }
+  if (docs && ((manifest_file != 0) || (nranks > 0)))
+  {
+      printf("ERROR: shards and ranks do not support per-sequence occurrences\n");
+      show_usage(argv[0], 1);
+  }
+  if ((cache_mib > 0) && ((manifest_file != 0) || (nranks > 0) || engine_bfs))
+  {
+      printf("ERROR: the hot k-mer cache (-C) does not support -m, -p or the breadth-first engine\n");
+      show_usage(argv[0], 1);
+  }
+  if (dedup.enabled && ((manifest_file != 0) || (nranks > 0)))
+  {
+      printf("ERROR: shards and ranks do not support collapsing duplicate sequences (-D)\n");
+      show_usage(argv[0], 1);
+  }
+  if (docs && unique_mode)
+  {
+      printf("ERROR: the unique-interval shortcut does not keep the BWT intervals (-d)\n");
+      show_usage(argv[0], 1);
+  }
+  if (unique_mode && (kernel_kind == 1))
+  {
+      printf("ERROR: the unique-interval shortcut requires the scalar kernel\n");
+      show_usage(argv[0], 1);
+  }
+
+  // clone of the kernels for the host
+  for (const isa_t *s = isas; (s->name != NULL) && (isa == NULL); s++)
+      if (((isa_name == 0) || (strcmp(isa_name, s->name) == 0)) && isa_supported(s))
+          isa = s;
+  if (isa == NULL)
+  {
+      printf("ERROR: instruction set %s unknown or not supported by this host\n",
+             (isa_name != 0)? isa_name : "base");
+      show_usage(argv[0], 1);
+  }
+  kernels = isa->kernels;
+  if ((kernel_kind == 1) && (find_kernel(NSEQS, 0, 1) == NULL))
+  {
+      printf("ERROR: the vector kernel requires AVX2 or AVX-512 (-i %s)\n", isa->name);
+      show_usage(argv[0], 1);
+  }
+  if (engine_bfs && (pool.enabled || unique_mode || nseqs_auto || core_seqs))
+  {
+      printf("ERROR: the breadth-first engine does not support -P, -u, -n auto or -n core\n");
+      show_usage(argv[0], 1);
+  }
+  if (share_slots && (core_seqs == 0))
+  {
+      printf("ERROR: shared slots require overlapped sequences per core (-n core)\n");
+      show_usage(argv[0], 1);
+  }
+  if (!nseqs_auto)
+  {
+      // with -n core, the prefetch and type of the kernels of the threads
+      kernel = find_kernel(nseqs, dual, kernel_kind == 1);
+      if (kernel == NULL)
+      {
+          printf("ERROR: no kernel for %u overlapped sequences\n", nseqs);
+          show_usage(argv[0], 1);
+      }
+  }
+  if ((manifest_file != 0) && (nranks > 0))
+  {
+      printf("ERROR: shards and ranks cannot be combined\n");
+      show_usage(argv[0], 1);
+  }
   if (seq_file == 0)
   {
       printf("ERROR: sequences file not specified\n");
       show_usage(argv[0], 1);
   }
+  if (docs && (out_file == 0))
+  {
+      printf("ERROR: output file not specified\n");
+      show_usage(argv[0], 1);
+  }
+  if ((strcmp(seq_file, "-") == 0) && (stream_seqs == 0))
+      stream_seqs = STREAM_SEQS;
+  if ((stream_seqs > 0) && ((manifest_file != 0) || (nranks > 0) || docs || dedup.enabled))
+  {
+      printf("ERROR: the streaming mode does not support -m, -p, -d or -D\n");
+      show_usage(argv[0], 1);
+  }
 
 #if LIBNUMA
 #ifndef KNL
@@ -516,77 +3065,159 @@ main(int argc, char *argv[])
 #endif
 #endif
 
-  printf("Loading FM-index...\n");
-  start_timer = omp_get_wtime();
-  load_SFM(fmi_file, &fmi);
-  end_timer = omp_get_wtime();
-  printf("OK. Index loaded in %fs\n", end_timer - start_timer);
+  if (nranks > 0)
+  {
+    mask_init(mask_64b);
+    run_ranks(fmi_file, seq_file, nranks, out_file);
+    return 0;
+  }
+
+  if (manifest_file == 0)
+  {
+    printf("Loading FM-index...\n");
+    start_timer = omp_get_wtime();
+    load_SFM(fmi_file, &fmi);
+    end_timer = omp_get_wtime();
+    printf("OK. Index loaded in %fs\n", end_timer - start_timer);
+    if (docs && ((fmi.n_seqs == 0) || (fmi.sa_rate == 0)))
+    {
+        printf("ERROR: fm-index does not store a collection of sequences\n");
+        exit(EXIT_FAILURE);
+    }
+    init_unique();
+    init_filter();
 
 #if LIBNUMA
-  // free huge pages in each node
-  hugepages_status();
-  printf(HLINE);
+    // free huge pages in each node
+    hugepages_status();
+    printf(HLINE);
 #endif
+  }
+
+  if (stream_seqs > 0)
+  {
+    mask_init(mask_64b);
+    run_stream(fmi_file, seq_file, out_file);
+    free_SFM(&fmi);
+    return 0;
+  }
 
   // Loading sequences into memory
   printf("Loading sequences...\n");
   start_timer = omp_get_wtime();
-  lines = malloc(lines_size*sizeof(char*));
-  lines_len = malloc(lines_size*sizeof(uint));
-  if ( (lines == NULL) || (lines_len == NULL) )
+  free_arenas();
+  count = load_sequences(seq_file, 0, -1, nthreads, &arenas, &narenas, &lines, &lines_len, &bases, &bytes);
+  end_timer = omp_get_wtime();
+  printf("OK. %.2f Msequences loaded in %fs (%.3f Mseq/s, %.1f MB/s)\n",
+          count/MEGA, end_timer - start_timer, (double)(count)/(MEGA*(end_timer - start_timer)),
+          bytes/(MEGA*(end_timer - start_timer)));
+  search_lines = lines;
+  search_lens = lines_len;
+  search_count = count;
+  if (dedup.enabled)
   {
-    printf("Error at malloc\n");
-    exit(EXIT_FAILURE);
+    start_timer = omp_get_wtime();
+    collapse_duplicates(lines, lines_len, count);
+    end_timer = omp_get_wtime();
+    printf("Duplicates collapsed: %.2f Mdistinct sequences (%.1f%% duplicates) in %fs (%.3f Mseq/s)\n",
+           dedup.count/MEGA, 100.0*(count - dedup.count)/count, end_timer - start_timer,
+           (double)(count)/(MEGA*(end_timer - start_timer)));
+    search_lines = dedup.lines;
+    search_lens = dedup.lines_len;
+    search_count = dedup.count;
+  }
+  // shards encode the sequences with the alphabet of each index
+  if (manifest_file == 0)
+  {
+    start_timer = omp_get_wtime();
+    read_offsets = pack_reads(search_lines, search_lens, search_count);
+    end_timer = omp_get_wtime();
+    printf("Sequences encoded: %.2fMiB 2-bit packed in %fs (%.3f Mseq/s)\n",
+           (double) read_store_bytes/MiB, end_timer - start_timer,
+           (double)(search_count)/(MEGA*(end_timer - start_timer)));
   }
+  printf(HLINE);
+  fflush(stdout);
 
-  fp = fopen(seq_file, "r");
-  if (fp == NULL)
+  // Mask initialization
+  mask_init(mask_64b);
+
+  if (manifest_file != 0)
   {
-    printf("Error opening file %s\n", seq_file);
-    exit(EXIT_FAILURE);
+    run_shards(manifest_file, lines, lines_len, count, out_file);
+    free(lines);
+    free(lines_len);
+    free_arenas();
+    return 0;
   }
 
-  while ((read = read_seq_from_fasta(fp, &(lines[count]))) >= 0)
+  if (cache_mib > 0) init_cache();
+
+  if (bind_policy >= 0)
   {
-    lines_len[count] = read;
-    bases += read;
-    count++;
-    if (count >= lines_size)
-    {
-      lines_size += 1000;
-      lines = realloc(lines, lines_size*sizeof(char*));
-      lines_len = realloc(lines_len, lines_size*sizeof(uint));
-    }
+    bind_threads(1);
+    fflush(stdout);
+  }
+  if (core_seqs > 0)
+  {
+    plan_slots(1);
+    fflush(stdout);
   }
-  fclose(fp);
-  end_timer = omp_get_wtime();
-  printf("OK. %.2f Msequences loaded in %fs (%.3f Mseq/s)\n",
-          count/MEGA, end_timer - start_timer, (double)(count)/(MEGA*(end_timer - start_timer)));
-  printf(HLINE);
-  fflush(stdout);
 
-  lines = realloc(lines, (count+1)*sizeof(char*));
-  lines_len = realloc(lines_len, (count+1)*sizeof(uint));
-  lines[count] = fmi.start;
-  lines_len[count] = strlen(fmi.start);
+  if (kernel == NULL)
+  {
+    kernel = calibrate(search_lines, search_lens, read_offsets, search_count, 1);
+    fflush(stdout);
+  }
 
   printf("Parameters\n");
   printf("- FM-index file: %s\n", fmi_file);
   printf("- Index size: %.1fGiB (%lu characters)\n", (double)(fmi.len)/GiB, fmi.len);
   printf("- Number of threads: %d\n", nthreads);
-  printf("- Overlapped sequences: %d\n", NSEQS);
+  if (engine_bfs)
+    printf("- Engine: breadth-first%s, %u sequences per thread and round\n",
+           engine_trie? ", shared-suffix trie" : "", bfs_seqs);
+  else
+    print_kernel(kernel);
+  if (batch_size > 0)
+    printf("- Batches: %u sequences%s\n", batch_size, pool.enabled? ", thread pool" : "");
+  else if (pool.enabled)
+    printf("- Batches: a single one, thread pool\n");
+  if (unique_min > 0)
+    printf("- Unique-interval shortcut: sequences with %u characters left or more\n", unique_min);
+  if (bloom_kmers > 0)
+    printf("- Bloom prefilter: %u %u-mers per sequence (%.1fKiB, %u hashes)\n", bloom_kmers,
+           fmi.bloom_k, fmi.n_bloom*BLOOM_BLOCK_BITS/8/1024.0, fmi.bloom_hashes);
+  if (hot_cache.entries != NULL)
+    printf("- Hot k-mer cache: %.1fMiB, %lu entries, suffixes of %u characters\n",
+           cache_mib, hot_cache.size, hot_cache.depth);
+  if (fmi.n_seqs > 0)
+    printf("- Sequences in the collection: %u\n", fmi.n_seqs);
   printf("- Sequence file: %s\n", seq_file);
   printf("- Number of bases: %.2f Gbases (%lu)\n", bases/GIGA, bases);
   printf("- Number of sequences: %.2f Mseq (%u)\n", count/MEGA, count);
+  if (dedup.enabled)
+    printf("- Distinct sequences searched: %.2f Mseq (%u)\n", search_count/MEGA, search_count);
   printf("- Average sequence length: %.2f bases\n", (double) bases/count);
-  printf("- Number of sequences processed per thread: %.1fM (%u)\n", (double) (count)/(MEGA*nthreads), count/nthreads);
+  printf("- Number of sequences processed per thread: %.1fM (%u)\n",
+         (double) (search_count)/(MEGA*nthreads), search_count/nthreads);
   printf(HLINE);
   printf("The kernel will be executed %d times.\n", nruns);
   printf("The *best* throughput will be reported (excluding the first iteration).\n");
   printf(HLINE);
 
-  // Mask initialization
-  mask_init(mask_64b);
+  // the occurrences of the duplicates come from the intervals of their sequence
+  if ((out_file != 0) || dedup.enabled)
+  {
+    intervals = malloc((search_count+1)*sizeof(interval_t));
+    if (intervals == NULL)
+    {
+      printf("Error at malloc\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+
+  if (pool.enabled) pool_start();
 
   // Executing the FM-index count
   printf("Starting search... \n");
@@ -603,8 +3234,14 @@ main(int argc, char *argv[])
       perf_enable();
 #endif
 
+      // every run starts with an empty cache
+      if (hot_cache.entries != NULL)
+        memset(hot_cache.entries, 0, hot_cache.size*sizeof(cache_entry_t));
+
       start_timer = omp_get_wtime();
-      lf[run] = search(lines, lines_len, count, &total[run], &sample_glfops[run]);
+      lf[run] = search(search_lines, search_lens, read_offsets, search_count, &total[run], &sample_glfops[run]);
+      if (hot_cache.entries != NULL) lf_cached[run] = cache_saved;
+      if (dedup.enabled) total[run] = dedup_total();
       end_timer = omp_get_wtime();
       sample[run] = end_timer - start_timer;
 
@@ -616,6 +3253,7 @@ main(int argc, char *argv[])
   }
 
   end0 = omp_get_wtime();
+  if (pool.enabled) pool_finish();
   printf("OK\n");
 
   /* Expected bases do not match with processed bases because fmi.start characters are processed */
@@ -640,12 +3278,41 @@ main(int argc, char *argv[])
       printf("%.2fG (%lu) ", lf[i]/(2.0*GIGA), lf[i]/2);
   printf("\n");
 #endif
-  printf("Total LFOP: %.2fG (expected %.2fG)\n", sum(lf, nruns)/GIGA, 2*nruns*bases/GIGA);
+  printf("Total LFOP: %.2fG (expected %.2fG, %.2fG skipped on empty intervals)\n",
+         sum(lf, nruns)/GIGA, 2*nruns*bases/GIGA, nruns*empty_skipped/GIGA);
   printf("Total time: %f\n", end0 - start0);
   printf("Raw throughput: %6.3f GLFOPS\n", sum(lf, nruns)/(end0 - start0)/GIGA);
   printf(HLINE);
 
-  metrics(sample, lf, sample_glfops, nruns);
+  printf("Empty-interval early exit (last run): %lu sequences, %.2fM LF steps skipped (%.1f%%)\n",
+         empty_reads, empty_skipped/MEGA, 100.0*empty_skipped/(lf[nruns-1] + empty_skipped));
+  if (unique_min > 0)
+    printf("Unique-interval shortcut (last run): %lu sequences, %.2fM LF steps saved\n",
+           unique_reads, (int64_t) unique_saved/MEGA);
+  if (dedup.enabled)
+    printf("Duplicate sequences: %u of %u (%.1f%%), %.2fM LF steps saved per run\n",
+           count - dedup.count, count, 100.0*(count - dedup.count)/count, 2*(bases - dedup.bases)/MEGA);
+  if (bloom_kmers > 0)
+    printf("Bloom prefilter (last run): %lu sequences rejected, %.2fM LF steps saved, "
+           "%.1f%% false positives (%lu of %lu sequences without occurrences searched)\n",
+           filter_reads, filter_saved/MEGA,
+           (filter_zeros > 0)? 100.0*(filter_zeros - filter_reads)/filter_zeros : 0.0,
+           filter_zeros - filter_reads, filter_zeros);
+  if (hot_cache.entries != NULL)
+  {
+    uint64_t used = 0;
+    for (uint64_t i = 0; i < hot_cache.size; i++)
+      used += (hot_cache.entries[i].key != CACHE_EMPTY);
+    printf("Hot k-mer cache (last run): %.1f%% hits (%lu of %lu lookups), %.2fM LF steps saved, "
+           "%.1f%% of the entries used\n",
+           (cache_probes > 0)? 100.0*cache_hits/cache_probes : 0.0, cache_hits, cache_probes,
+           cache_saved/MEGA, 100.0*used/hot_cache.size);
+  }
+  if (engine_trie)
+    printf("Shared-suffix trie (last run): %.2fM LF steps shared (%.1f%%)\n",
+           trie_shared/MEGA, 100.0*trie_shared/(lf[nruns-1] + empty_skipped + trie_shared));
+  balance();
+  metrics(sample, lf, lf_cached, sample_glfops, nruns);
   printf(HLINE);
 
 #ifdef PERF
@@ -654,11 +3321,64 @@ main(int argc, char *argv[])
   printf(HLINE);
 #endif
 
-  if (lines)
+  if (dedup.enabled)
   {
-    for(uint i=0; i<count; i++) free(lines[i]);
-    free(lines);
+    // per-read results: fanned out from the distinct sequences
+    if (out_file != 0)
+    {
+      interval_t *distinct = intervals;
+      intervals = malloc((count+1)*sizeof(interval_t));
+      if (intervals == NULL)
+      {
+        printf("Error at malloc\n");
+        exit(EXIT_FAILURE);
+      }
+      #pragma omp parallel for
+      for (uint i = 0; i < count; i++)
+        intervals[i] = distinct[dedup.read[i]];
+      free(distinct);
+    }
+    else
+      free(intervals);
+    free(dedup.lines);
+    free(dedup.lines_len);
+    free(dedup.read);
+    free(dedup.copies);
+  }
+
+  if (out_file != 0)
+  {
+    fp = fopen(out_file, "w");
+    if (fp == NULL)
+    {
+      printf("Error opening file %s\n", out_file);
+      exit(EXIT_FAILURE);
+    }
+    start_timer = omp_get_wtime();
+    if (docs)
+    {
+      uint64_t located = count_docs(lines_len, count, fp);
+      end_timer = omp_get_wtime();
+      printf("Occurrences per sequence: %.2f Mrows located in %fs (%.3f Mrows/s)\n",
+             located/MEGA, end_timer - start_timer, located/(MEGA*(end_timer - start_timer)));
+    }
+    else
+    {
+      for (uint i = 0; i < count; i++)
+        fprintf(fp, "%u\t%lu\n", i, intervals[i].end - intervals[i].start);
+    }
+    fclose(fp);
+    printf("Per-read occurrences written to file %s\n", out_file);
+    printf(HLINE);
+    free(intervals);
   }
+
+  free(lines);
+  free(lines_len);
+  free_arenas();
+  free(hot_cache.entries);
+  free(read_store);
+  free(read_offsets);
   free_SFM(&fmi);
   return 0;
 }
@@ -0,0 +1,266 @@
+/*
+ * Copyright 2019, José-Manuel Herruzo <jmherruzo@uma.es>,
+ *                 Jesús Alastruey-Benedé <jalastru@unizar.es>,
+ *                 Pablo Ibáñez-Marín <imarin@unizar.es>
+ *
+ * This file is part of the bvSFM sequence alignment package.
+ *
+ * bvSFM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bvSFM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bvSFM. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * If you publish any work that uses this software, please cite the following paper:
+ *
+ * J.M. Herruzo, S. González-Navarro, P. Ibáñez, V. Viñals, J. Alastruey-Benedé, and Óscar Plata.
+ * Accelerating Sequence Alignments Based on FM-Index Using the Intel KNL Processor.
+ * IEEE/ACM Transactions on Computational Biology and Bioinformatics (TCBB 2019).
+ * DOI: 10.1109/TCBB.2018.2884701 
+ * 
+ * @article{herruzo2019TCBB,
+ *  author    = {José Manuel Herruzo, Sonia González-Navarro, Pablo Ibáñez, Víctor Viñals, Jesús Alastruey-Benedé, and Óscar Plata},
+ *  journal = {IEEE/ACM Transactions on Computational Biology and Bioinformatics (TCBB 2019)},
+ *  title     = {Accelerating Sequence Alignments Based on FM-Index Using the Intel KNL Processor},
+ *  year      = {2019},
+ *  doi       = {10.1109/TCBB.2018.2884701}
+ * }
+ *
+ */
+
+/*
+ * Instruction-set clone of the search kernels, included by k2d64bv_fcount.c
+ * once per target (#pragma GCC target) with KERNEL_ISA set to the suffix of
+ * the clone:
+ *
+ *   #pragma GCC target("popcnt,avx2,bmi2")
+ *   #define KERNEL_ISA _avx2
+ *   #include "k2d64bv_isa.h"
+ *
+ * defines k2_LF_avx2, the kernels of k2d64bv_kernel.h for every number of
+ * overlapped sequences (run_16_sp_avx2, run_16_dp_avx2,
+ * run_simd_16_avx2, ...) and their table kernels_avx2. The vector kernels
+ * are only built when the target has AVX2 or AVX-512.
+ * KERNEL_ISA is undefined at the end of the file.
+ */
+
+#ifndef KERNEL_ISA
+    #error "KERNEL_ISA must be defined before including k2d64bv_isa.h"
+#endif
+
+// name ## KERNEL_ISA
+#define ISA_NAME(name) KERNEL_CAT(name, KERNEL_ISA, , )
+
+// the kernels call the helpers by their plain names: a macro is not expanded
+// again inside its own expansion, so k2_LF becomes k2_LF ## KERNEL_ISA
+#define k2_LF      ISA_NAME(k2_LF)
+#define popcnt256  ISA_NAME(popcnt256)
+#define v_popcnt   ISA_NAME(v_popcnt)
+#define v_symbols  ISA_NAME(v_symbols)
+#define v_LF       ISA_NAME(v_LF)
+
+// it really computes k2_LF(idx-1)
+static __forceinline uint64_t
+k2_LF(uint64_t idx, SFM_entry_t *entry)
+{
+    // uint32_t entry_id     = idx / D_VAL;    // SFM entry index
+    uint32_t entry_offset = idx % D_VAL;    // offset en la SFM entry
+    uint64_t count = entry->counter;
+    count += _popcnt64(entry->data & mask_64b[entry_offset]);
+    return count;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Vector kernel: the slots of a group are processed in the lanes of a vector
+// register (AVX-512: 8 lanes, AVX2: 4 lanes). Counters and bitmaps are
+// gathered, popcounts are computed with VPOPCNTQ (or a nibble LUT) and only
+// the lanes of finished sequences are refilled with scalar code.
+////////////////////////////////////////////////////////////////////////////////
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#define SIMD_KERNEL 1
+
+// popcount of each 64-bit lane of a 256-bit vector (nibble LUT)
+static __forceinline __m256i
+popcnt256(__m256i a)
+{
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_shuffle_epi8(lut, _mm256_and_si256(a, low));
+    __m256i hi = _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(a, 4), low));
+    return _mm256_sad_epu8(_mm256_add_epi8(lo, hi), _mm256_setzero_si256());
+}
+
+#if defined(__AVX512F__)
+  #define VLANES 8
+  #define vec_t             __m512i
+  #define V_LOAD(p)         _mm512_loadu_si512((const void*)(p))
+  #define V_STORE(p, a)     _mm512_storeu_si512((void*)(p), a)
+  #define V_SET1(x)         _mm512_set1_epi64(x)
+  #define V_ADD(a, b)       _mm512_add_epi64(a, b)
+  #define V_SUB(a, b)       _mm512_sub_epi64(a, b)
+  #define V_AND(a, b)       _mm512_and_si512(a, b)
+  #define V_SRLI(a, n)      _mm512_srli_epi64(a, n)
+  #define V_SLLI(a, n)      _mm512_slli_epi64(a, n)
+  #define V_SLLV(a, n)      _mm512_sllv_epi64(a, n)
+  #define V_GATHER64(b, i)  _mm512_i64gather_epi64(i, (const void*)(b), 8)
+  // lanes with a negative value
+  #define V_NEGATIVE(a)     ((uint)_mm512_cmplt_epi64_mask(a, _mm512_setzero_si512()))
+  // lanes with an empty interval (start >= end)
+  #define V_EMPTY(s, e)     ((uint)_mm512_cmpge_epu64_mask(s, e))
+
+  #if defined(__AVX512VPOPCNTDQ__)
+    static __forceinline vec_t
+    v_popcnt(vec_t a)
+    {
+        return _mm512_popcnt_epi64(a);
+    }
+  #elif defined(__AVX512BW__)
+    static __forceinline vec_t
+    v_popcnt(vec_t a)
+    {
+        const __m512i lut = _mm512_broadcast_i32x4(
+                _mm_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4));
+        const __m512i low = _mm512_set1_epi8(0x0f);
+        __m512i lo = _mm512_shuffle_epi8(lut, _mm512_and_si512(a, low));
+        __m512i hi = _mm512_shuffle_epi8(lut, _mm512_and_si512(_mm512_srli_epi16(a, 4), low));
+        return _mm512_sad_epu8(_mm512_add_epi8(lo, hi), _mm512_setzero_si512());
+    }
+  #else
+    // KNL: no byte shuffles on 512-bit vectors
+    static __forceinline vec_t
+    v_popcnt(vec_t a)
+    {
+        __m512i lo = _mm512_castsi256_si512(popcnt256(_mm512_castsi512_si256(a)));
+        return _mm512_inserti64x4(lo, popcnt256(_mm512_extracti64x4_epi64(a, 1)), 1);
+    }
+  #endif
+
+  // k2 symbol at each bit address of the packed sequences (PACKED_SYMBOL)
+  static __forceinline vec_t
+  v_symbols(vec_t bit)
+  {
+      __m256i word = _mm512_i64gather_epi32(V_SRLI(bit, 3), NULL, 1);
+      vec_t pair = _mm512_srlv_epi64(_mm512_cvtepu32_epi64(word), V_AND(bit, V_SET1(7)));
+      return V_AND(pair, V_SET1(K2_SYMBOLS - 1));
+  }
+#else
+  #define VLANES 4
+  #define vec_t             __m256i
+  #define V_LOAD(p)         _mm256_loadu_si256((const __m256i*)(p))
+  #define V_STORE(p, a)     _mm256_storeu_si256((__m256i*)(p), a)
+  #define V_SET1(x)         _mm256_set1_epi64x(x)
+  #define V_ADD(a, b)       _mm256_add_epi64(a, b)
+  #define V_SUB(a, b)       _mm256_sub_epi64(a, b)
+  #define V_AND(a, b)       _mm256_and_si256(a, b)
+  #define V_SRLI(a, n)      _mm256_srli_epi64(a, n)
+  #define V_SLLI(a, n)      _mm256_slli_epi64(a, n)
+  #define V_SLLV(a, n)      _mm256_sllv_epi64(a, n)
+  #define V_GATHER64(b, i)  _mm256_i64gather_epi64((const long long*)(b), i, 8)
+  #define V_NEGATIVE(a)     ((uint)_mm256_movemask_pd(_mm256_castsi256_pd(a)))
+  // rows fit in 63 bits: signed compare
+  #define V_EMPTY(s, e)     (~(uint)_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(e, s))) & 0xf)
+
+  static __forceinline vec_t
+  v_popcnt(vec_t a)
+  {
+      return popcnt256(a);
+  }
+
+  static __forceinline vec_t
+  v_symbols(vec_t bit)
+  {
+      __m128i word = _mm256_i64gather_epi32(NULL, V_SRLI(bit, 3), 1);
+      vec_t pair = _mm256_srlv_epi64(_mm256_cvtepu32_epi64(word), V_AND(bit, V_SET1(7)));
+      return V_AND(pair, V_SET1(K2_SYMBOLS - 1));
+  }
+#endif
+
+// LFs of VLANES rows: counter of the entry + popcount(data & mask_64b[row % 64])
+static __forceinline vec_t
+v_LF(vec_t row, vec_t symbol)
+{
+    const uint64_t *words = (const uint64_t*) fmi.entries;
+    // 16-byte entries: counter is word 2*entry, data is word 2*entry + 1
+    vec_t entry = V_SLLI(V_ADD(V_SLLI(V_SRLI(row, 6), 4), symbol), 1);
+    // mask_64b[i] = ~0 << (64 - i), 0 for i = 0
+    vec_t mask  = V_SLLV(V_SET1(-1), V_SUB(V_SET1(D_VAL), V_AND(row, V_SET1(D_VAL - 1))));
+    vec_t data  = V_AND(V_GATHER64(words + 1, entry), mask);
+    return V_ADD(V_GATHER64(words, entry), v_popcnt(data));
+}
+
+#else
+#define SIMD_KERNEL 0
+#endif
+
+#define KERNEL_NSEQS 2
+#include "k2d64bv_kernel.h"
+#define KERNEL_NSEQS 4
+#include "k2d64bv_kernel.h"
+#define KERNEL_NSEQS 6
+#include "k2d64bv_kernel.h"
+#define KERNEL_NSEQS 8
+#include "k2d64bv_kernel.h"
+#define KERNEL_NSEQS 12
+#include "k2d64bv_kernel.h"
+#define KERNEL_NSEQS 16
+#include "k2d64bv_kernel.h"
+#define KERNEL_NSEQS 20
+#include "k2d64bv_kernel.h"
+#define KERNEL_NSEQS 24
+#include "k2d64bv_kernel.h"
+#define KERNEL_NSEQS 32
+#include "k2d64bv_kernel.h"
+#define KERNEL_NSEQS 40
+#include "k2d64bv_kernel.h"
+
+#if SIMD_KERNEL
+  #define KERNEL_SIMD(n)  { n, 0, VLANES, KERNEL_CAT(run_simd_, n, , KERNEL_ISA) },
+#else
+  #define KERNEL_SIMD(n)
+#endif
+#define KERNEL_ENTRIES(n) { n, 0, 0, KERNEL_CAT(run_, n, _sp, KERNEL_ISA) }, \
+                          { n, 1, 0, KERNEL_CAT(run_, n, _dp, KERNEL_ISA) }, \
+                          KERNEL_SIMD(n)
+
+static const kernel_t ISA_NAME(kernels)[] = {
+  KERNEL_ENTRIES(2)  KERNEL_ENTRIES(4)  KERNEL_ENTRIES(6)  KERNEL_ENTRIES(8)
+  KERNEL_ENTRIES(12) KERNEL_ENTRIES(16) KERNEL_ENTRIES(20) KERNEL_ENTRIES(24)
+  KERNEL_ENTRIES(32) KERNEL_ENTRIES(40)
+  { 0, 0, 0, NULL }
+};
+
+#undef KERNEL_ENTRIES
+#undef KERNEL_SIMD
+#if SIMD_KERNEL
+  #undef VLANES
+  #undef vec_t
+  #undef V_LOAD
+  #undef V_STORE
+  #undef V_SET1
+  #undef V_ADD
+  #undef V_SUB
+  #undef V_AND
+  #undef V_SRLI
+  #undef V_SLLI
+  #undef V_SLLV
+  #undef V_GATHER64
+  #undef V_NEGATIVE
+  #undef V_EMPTY
+#endif
+#undef SIMD_KERNEL
+#undef k2_LF
+#undef popcnt256
+#undef v_popcnt
+#undef v_symbols
+#undef v_LF
+#undef ISA_NAME
+#undef KERNEL_ISA
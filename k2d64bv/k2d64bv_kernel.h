@@ -0,0 +1,288 @@
+/*
+ * Copyright 2019, José-Manuel Herruzo <jmherruzo@uma.es>,
+ *                 Jesús Alastruey-Benedé <jalastru@unizar.es>,
+ *                 Pablo Ibáñez-Marín <imarin@unizar.es>
+ *
+ * This file is part of the bvSFM sequence alignment package.
+ *
+ * bvSFM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bvSFM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bvSFM. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * If you publish any work that uses this software, please cite the following paper:
+ *
+ * J.M. Herruzo, S. González-Navarro, P. Ibáñez, V. Viñals, J. Alastruey-Benedé, and Óscar Plata.
+ * Accelerating Sequence Alignments Based on FM-Index Using the Intel KNL Processor.
+ * IEEE/ACM Transactions on Computational Biology and Bioinformatics (TCBB 2019).
+ * DOI: 10.1109/TCBB.2018.2884701 
+ * 
+ * @article{herruzo2019TCBB,
+ *  author    = {José Manuel Herruzo, Sonia González-Navarro, Pablo Ibáñez, Víctor Viñals, Jesús Alastruey-Benedé, and Óscar Plata},
+ *  journal = {IEEE/ACM Transactions on Computational Biology and Bioinformatics (TCBB 2019)},
+ *  title     = {Accelerating Sequence Alignments Based on FM-Index Using the Intel KNL Processor},
+ *  year      = {2019},
+ *  doi       = {10.1109/TCBB.2018.2884701}
+ * }
+ *
+ */
+
+/*
+ * Search kernel template, included by k2d64bv_isa.h once per number of
+ * overlapped sequences:
+ *
+ *   #define KERNEL_NSEQS 16
+ *   #include "k2d64bv_kernel.h"
+ *
+ * defines, for the clone KERNEL_ISA (e.g. _avx2), run_16_sp_avx2 (prefetch
+ * into L2), run_16_dp_avx2 (prefetch into L2 and L1) and, if the target
+ * has AVX2 or AVX-512, the vector kernel run_simd_16_avx2.
+ * A kernel runs in one thread and takes its sequences in chunks from
+ * next_chunk(): it returns when it runs out of them or, if persistent (thread
+ * pool), when the pool is stopped. Slots are refilled as soon as their
+ * sequence finishes, whatever its batch.
+ * KERNEL_NSEQS is undefined at the end of the file.
+ */
+
+#ifndef KERNEL_NSEQS
+    #error "KERNEL_NSEQS must be defined before including k2d64bv_kernel.h"
+#endif
+
+// prefix ## KERNEL_NSEQS ## suffix ## KERNEL_ISA
+#define KERNEL_NAME(prefix, suffix) KERNEL_CAT(prefix, KERNEL_NSEQS, suffix, KERNEL_ISA)
+
+// 1 if the kernel has to return: no sequences left (in the slots or in the
+// chunk waiting for free slots, -S) and, if persistent, pool stopped
+#define KERNEL_DONE()                                                          \
+  ((active == 0) && (next_line == chunk.end) &&                                \
+   (!persistent || __atomic_load_n(&pool.stop, __ATOMIC_ACQUIRE)))
+
+static inline __attribute__ ((always_inline)) void
+KERNEL_NAME(run_, )(chunk_fn next_chunk, int persistent, thread_stats_t *stats, const int dual)
+{
+    uint64_t start[KERNEL_NSEQS], end[KERNEL_NSEQS];
+    SFM_entry_t *start_bl[KERNEL_NSEQS], *end_bl[KERNEL_NSEQS];
+    uint8_t next_symbol[KERNEL_NSEQS];
+    int index[KERNEL_NSEQS];
+    uint line_index[KERNEL_NSEQS], lengths[KERNEL_NSEQS];
+    char * working_lines[KERNEL_NSEQS];
+    uint8_t * packed_lines[KERNEL_NSEQS];
+    uint64_t packed_base[KERNEL_NSEQS];
+    batch_t * slot_batch[KERNEL_NSEQS];
+    uint64_t cache_keys[KERNEL_NSEQS];
+    int cache_at[KERNEL_NSEQS];
+    uint64_t lf = 0, unique = 0, saved = 0, empty = 0, skipped = 0;
+    uint64_t probes = 0, hits = 0, cached = 0, filtered = 0, fsaved = 0, zeros = 0;
+    chunk_t chunk = { NULL, 0, 0 };
+    uint next_line = 0, active = 0;
+    uint *tokens = stats->tokens;
+    // char seq_tmp[32] = {0};
+
+    stats->start = omp_get_wtime();
+
+    // Get starting positions for the sequences (LUT): every slot starts finished
+    for(uint j=0; j < KERNEL_NSEQS; j++)
+    {
+        index[j] = -KSTEPS;
+        slot_batch[j] = NULL;
+        _CHECK_FINISHED_SEQ(j);
+        // Encode *two* chars for the starting pairs (uint16_t)
+        _ENCODE_CHARS(j);
+
+#if 0
+        printf("  start/end[%d] = %lu/%lu (LUT)\n", j, start[j], end[j]);
+        printf("  index[%2u] = %2d/%2d ->", j, index[j] + KSTEPS, lengths[j] - 1);
+        decode_symbols(next_symbol[j], seq_tmp, fmi.alphabet, BITS_PER_SYMBOL, KSTEPS);
+        printf("  next_symbol[%2d] = %2u = %s ->", j, next_symbol[j], seq_tmp);
+        fflush(stdout);
+#endif
+
+        // Get starting blocks to search
+        start_bl[j] = &fmi.entries[(start[j]/D_VAL)*K2_SYMBOLS + next_symbol[j]];
+        end_bl[j]   = &fmi.entries[(  end[j]/D_VAL)*K2_SYMBOLS + next_symbol[j]];
+
+        // Prefetch blocks for next execution of sequence j into L2
+        _mm_prefetch((char*) start_bl[j], PREFETCH_HINT_L2);
+        _mm_prefetch((char*) end_bl[j],   PREFETCH_HINT_L2);
+    }
+
+    while(!KERNEL_DONE())
+    {
+        /* start of loop to analyze */
+        IACA_START
+
+        // idle pool thread: let the other threads of the core run
+        if (active == 0) sched_yield();
+
+        // update stats: LFs of the slots with a sequence (not the idle ones)
+        lf += 2*KSTEPS*active;
+
+        for (uint j=0; j < KERNEL_NSEQS; j++)
+        {
+            // Prefetch blocks for sequence j into L1
+            if (dual)
+            {
+              _mm_prefetch((char*) start_bl[j], PREFETCH_HINT_L1);
+              _mm_prefetch((char*) end_bl[j],   PREFETCH_HINT_L1);
+            }
+
+            // LFs for sequence j
+            start[j] = k2_LF(start[j], start_bl[j]);
+            end[j]   = k2_LF(end[j]  , end_bl[j]);
+
+            // printf("  start/end[%2u] = %2lu/%2lu\n", j, start[j], end[j]);
+        
+            // Check if finished sequence j
+            _CACHE_STORE(j);
+            _CHECK_UNIQUE_SEQ(j);
+            _CHECK_FINISHED_SEQ(j);
+            _ENCODE_CHARS(j);
+
+#if 0
+            printf("  index[%2u] = %2d/%2d ->", j, index[j] + KSTEPS, lengths[j] - 1);
+            decode_symbols(next_symbol[j], seq_tmp, fmi.alphabet, BITS_PER_SYMBOL, KSTEPS);
+            printf("  next_symbol[%2d] = %2u = %s ->", j, next_symbol[j], seq_tmp);
+            fflush(stdout);
+#endif
+
+            // Calculate blocks for sequence j
+            start_bl[j] = &fmi.entries[(start[j]/D_VAL)*K2_SYMBOLS + next_symbol[j]];
+            end_bl[j]   = &fmi.entries[(end[j]/D_VAL)*K2_SYMBOLS   + next_symbol[j]];
+
+            // Prefetch blocks for next execution of sequence j into L2
+            _mm_prefetch((char*) start_bl[j], PREFETCH_HINT_L2);
+            _mm_prefetch((char*) end_bl[j],   PREFETCH_HINT_L2);
+            ////////////////////////////////////////////////////////////////////
+        }
+    }
+
+    stats->end = omp_get_wtime();
+    _STORE_STATS();
+
+    /* end of loop to analyze */
+    IACA_END
+}
+
+static void __attribute__ ((noinline))
+KERNEL_NAME(run_, _sp)(chunk_fn next_chunk, int persistent, thread_stats_t *stats)
+{
+  KERNEL_NAME(run_, )(next_chunk, persistent, stats, 0);
+}
+
+static void __attribute__ ((noinline))
+KERNEL_NAME(run_, _dp)(chunk_fn next_chunk, int persistent, thread_stats_t *stats)
+{
+  KERNEL_NAME(run_, )(next_chunk, persistent, stats, 1);
+}
+
+#if SIMD_KERNEL
+// KERNEL_NSEQS slots rounded up to whole groups of VLANES lanes
+#define KERNEL_VSLOTS (((KERNEL_NSEQS + VLANES - 1)/VLANES)*VLANES)
+
+static void __attribute__ ((noinline))
+KERNEL_NAME(run_simd_, )(chunk_fn next_chunk, int persistent, thread_stats_t *stats)
+{
+    uint64_t start[KERNEL_VSLOTS], end[KERNEL_VSLOTS], next_symbol[KERNEL_VSLOTS], prefetch[KERNEL_VSLOTS];
+    int64_t index[KERNEL_VSLOTS];
+    uint line_index[KERNEL_VSLOTS], lengths[KERNEL_VSLOTS];
+    char * working_lines[KERNEL_VSLOTS];
+    uint8_t * packed_lines[KERNEL_VSLOTS];
+    uint64_t packed_base[KERNEL_VSLOTS];
+    batch_t * slot_batch[KERNEL_VSLOTS];
+    uint64_t cache_keys[KERNEL_VSLOTS];
+    int cache_at[KERNEL_VSLOTS];
+    uint64_t lf = 0, unique = 0, saved = 0, empty = 0, skipped = 0;
+    uint64_t probes = 0, hits = 0, cached = 0, filtered = 0, fsaved = 0, zeros = 0;
+    chunk_t chunk = { NULL, 0, 0 };
+    uint next_line = 0, active = 0;
+    uint *tokens = stats->tokens;
+
+    stats->start = omp_get_wtime();
+
+    // Get starting positions for the sequences (LUT): every slot starts finished
+    for(uint j=0; j < KERNEL_VSLOTS; j++)
+    {
+        index[j] = -KSTEPS;
+        slot_batch[j] = NULL;
+        _CHECK_FINISHED_SEQ(j);
+        // Encode *two* chars for the starting pairs (uint16_t)
+        _ENCODE_CHARS(j);
+
+        _mm_prefetch((char*) &fmi.entries[(start[j]/D_VAL)*K2_SYMBOLS + next_symbol[j]], PREFETCH_HINT_L2);
+        _mm_prefetch((char*) &fmi.entries[(  end[j]/D_VAL)*K2_SYMBOLS + next_symbol[j]], PREFETCH_HINT_L2);
+    }
+
+    while(!KERNEL_DONE())
+    {
+        /* start of loop to analyze */
+        IACA_START
+
+        // idle pool thread: let the other threads of the core run
+        if (active == 0) sched_yield();
+
+        // update stats: LFs of the slots with a sequence (not the idle ones)
+        lf += 2*KSTEPS*active;
+
+        for (uint g=0; g < KERNEL_VSLOTS; g += VLANES)
+        {
+            // LFs for the lanes of group g
+            vec_t symbol = V_LOAD(&next_symbol[g]);
+            V_STORE(&start[g], v_LF(V_LOAD(&start[g]), symbol));
+            V_STORE(&end[g],   v_LF(V_LOAD(&end[g]),   symbol));
+
+            // Cache the intervals of the lanes at the cached depth
+            if (hot_cache.entries != NULL)
+                for (uint j=g; j < g + VLANES; j++)
+                {
+                    _CACHE_STORE(j);
+                }
+
+            // Refill the lanes of finished sequences and of empty intervals
+            uint finished = V_NEGATIVE(V_LOAD(&index[g])) |
+                            V_EMPTY(V_LOAD(&start[g]), V_LOAD(&end[g]));
+            while (finished)
+            {
+                uint j = g + __builtin_ctz(finished);
+                finished &= finished - 1;
+                _CHECK_FINISHED_SEQ(j);
+            }
+
+            // Encode the two next chars of every lane
+            vec_t idx = V_LOAD(&index[g]);
+            symbol = v_symbols(V_SUB(V_LOAD(&packed_base[g]), V_SLLI(idx, 1)));
+            V_STORE(&index[g], V_SUB(idx, V_SET1(KSTEPS)));
+            V_STORE(&next_symbol[g], symbol);
+
+            // Prefetch blocks for next execution of group g into L2
+            vec_t start_bl = V_ADD(V_SLLI(V_SRLI(V_LOAD(&start[g]), 6), 4), symbol);
+            vec_t end_bl   = V_ADD(V_SLLI(V_SRLI(V_LOAD(&end[g]), 6), 4), symbol);
+            V_STORE(&prefetch[g], start_bl);
+            for (uint j=g; j < g + VLANES; j++)
+                _mm_prefetch((char*) &fmi.entries[prefetch[j]], PREFETCH_HINT_L2);
+            V_STORE(&prefetch[g], end_bl);
+            for (uint j=g; j < g + VLANES; j++)
+                _mm_prefetch((char*) &fmi.entries[prefetch[j]], PREFETCH_HINT_L2);
+        }
+    }
+
+    stats->end = omp_get_wtime();
+    _STORE_STATS();
+
+    /* end of loop to analyze */
+    IACA_END
+}
+
+#undef KERNEL_VSLOTS
+#endif
+
+#undef KERNEL_DONE
+#undef KERNEL_NAME
+#undef KERNEL_NSEQS
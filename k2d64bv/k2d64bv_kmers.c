@@ -0,0 +1,464 @@
+/*
+ * Copyright 2019, José-Manuel Herruzo <jmherruzo@uma.es>,
+ *                 Jesús Alastruey-Benedé <jalastru@unizar.es>,
+ *                 Pablo Ibáñez-Marín <imarin@unizar.es>
+ *
+ * This file is part of the bvSFM sequence alignment package.
+ *
+ * bvSFM is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * bvSFM is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with bvSFM. If not, see <http://www.gnu.org/licenses/>.
+ *
+ * If you publish any work that uses this software, please cite the following paper:
+ *
+ * J.M. Herruzo, S. González-Navarro, P. Ibáñez, V. Viñals, J. Alastruey-Benedé, and Óscar Plata.
+ * Accelerating Sequence Alignments Based on FM-Index Using the Intel KNL Processor.
+ * IEEE/ACM Transactions on Computational Biology and Bioinformatics (TCBB 2019).
+ * DOI: 10.1109/TCBB.2018.2884701 
+ * 
+ * @article{herruzo2019TCBB,
+ *  author    = {José Manuel Herruzo, Sonia González-Navarro, Pablo Ibáñez, Víctor Viñals, Jesús Alastruey-Benedé, and Óscar Plata},
+ *  journal = {IEEE/ACM Transactions on Computational Biology and Bioinformatics (TCBB 2019)},
+ *  title     = {Accelerating Sequence Alignments Based on FM-Index Using the Intel KNL Processor},
+ *  year      = {2019},
+ *  doi       = {10.1109/TCBB.2018.2884701}
+ * }
+ *
+ */
+
+/*
+ * k-mer spectrum of the reference: all the k-mers of length 1..K that occur
+ * in the indexed text and their number of occurrences.
+ *
+ * The k-mers are enumerated with a depth-first traversal of the fm-index:
+ * each step extends the BWT interval of a k-mer S to the intervals of the
+ * 16 k-mers cS (c: k2 symbol, two characters). Odd-length k-mers grow from
+ * the 4 single characters, and even-length ones from the 16 pairs of
+ * characters, so neither the text nor the suffix array is needed.
+ * The top of the tree is expanded level by level until there are enough
+ * subtrees to balance the threads, and then the subtrees are traversed in
+ * parallel. Empty intervals (and intervals with less occurrences than the
+ * minimum count) are pruned, as all their extensions are also empty.
+ */
+
+#include <stdio.h>
+#include <omp.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <string.h>
+
+#include "../aux.h"
+#include "../file_mng.h"
+#include "k2d64bv.h"
+
+#ifndef THREADS
+    #ifdef KNL
+        #define THREADS 256
+    #else
+        #define THREADS 28
+    #endif
+#endif
+
+// maximum k-mer length
+#define MAX_KMER_LEN 1024
+
+// subtrees per thread when splitting the traversal
+#define SUBTREES_PER_THREAD 64
+
+////////////////////////////////////////////////////////////////////////////////
+// Module variables
+////////////////////////////////////////////////////////////////////////////////
+
+// node of the traversal: BWT interval [start, end) of a k-mer
+typedef struct kmer_node {
+  uint64_t start;
+  uint64_t end;
+  uint len;
+  char *kmer;
+} kmer_node_t;
+
+static SFM_t fmi;
+static uint32_t nthreads = THREADS;
+static uint kmer_len = 0;
+static uint64_t min_count = 1;
+
+// input options
+static const char *optString = "f:k:c:t:o:h?";
+static const struct option longOpts[] =
+{
+    {"fmindex",   required_argument,  NULL,   'f'},
+    {"length",    required_argument,  NULL,   'k'},
+    {"min-count", required_argument,  NULL,   'c'},
+    {"nthreads",  required_argument,  NULL,   't'},
+    {"output",    required_argument,  NULL,   'o'},
+    {"help",      no_argument,        NULL,   'h'},
+    {NULL,                  0,        NULL,    0 }
+};
+/*----------------------------------------------------------------------------*/
+
+static struct option_help {
+    const char *long_opt, *short_opt, *desc;
+} opts_help[] = {
+    { "--fmindex", "-f",
+      "file storing the fm-index" },
+    { "--length", "-k",
+      "maximum k-mer length" },
+    { "--min-count", "-c",
+      "minimum number of occurrences of the reported k-mers (default 1)" },
+    { "--nthreads", "-t",
+      "number of threads" },
+    { "--output", "-o",
+      "file to write the k-mers and their number of occurrences" },
+    { "--help", "-h",
+      "show program usage"},
+    { NULL, NULL, NULL }
+};
+
+////////////////////////////////////////////////////////////////////////////////
+// Auxiliary functions
+////////////////////////////////////////////////////////////////////////////////
+
+static void
+show_usage(char *name, int exit_code)
+{
+    struct option_help *h;
+
+    printf("usage: %s options\n", name);
+    for (h = opts_help; h->long_opt; h++)
+    {
+        printf(" %s, %s\n ", h->short_opt, h->long_opt);
+        printf("    %s\n", h->desc);
+    }
+    exit(exit_code);
+}
+/*----------------------------------------------------------------------------*/
+
+// appends a node to a list
+static void
+push_node(kmer_node_t **nodes, uint64_t *n, uint64_t *size, kmer_node_t node)
+{
+  if (*n == *size)
+  {
+    *size = (*size == 0)? 64 : 2*(*size);
+    *nodes = realloc(*nodes, (*size)*sizeof(kmer_node_t));
+    if (*nodes == NULL)
+    {
+      printf("Error at malloc\n");
+      exit(EXIT_FAILURE);
+    }
+  }
+  (*nodes)[(*n)++] = node;
+}
+
+// k-mer cS, with c a k2 symbol
+static char *
+extend_kmer(const char *kmer, uint len, uint c)
+{
+  char *ext = malloc(len + KSTEPS);
+  if (ext == NULL)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+  ext[0] = fmi.alphabet[c >> BITS_PER_SYMBOL];
+  ext[1] = fmi.alphabet[c & (SYMBOLS - 1)];
+  memcpy(ext + KSTEPS, kmer, len);
+  return ext;
+}
+
+// depth-first traversal of the subtree of a k-mer stored at kmer[0..len)
+// (there is room for kmer_len - len characters before it)
+static void
+traverse(uint64_t start, uint64_t end, char *kmer, uint len, FILE *out,
+         uint64_t *distinct, uint64_t *lf)
+{
+  uint64_t starts[K2_SYMBOLS], ends[K2_SYMBOLS];
+
+  fprintf(out, "%.*s\t%lu\n", len, kmer, end - start);
+  distinct[len]++;
+  if (len + KSTEPS > kmer_len) return;
+
+  extend_SFM(&fmi, start, end, starts, ends);
+  *lf += 2*K2_SYMBOLS;
+
+  for (uint c = 0; c < K2_SYMBOLS; c++)
+  {
+    if (ends[c] - starts[c] < min_count) continue;
+    kmer[-2] = fmi.alphabet[c >> BITS_PER_SYMBOL];
+    kmer[-1] = fmi.alphabet[c & (SYMBOLS - 1)];
+    traverse(starts[c], ends[c], kmer - KSTEPS, len + KSTEPS, out, distinct, lf);
+  }
+}
+
+// k-mer spectrum: returns the number of LF operations
+static uint64_t
+spectrum(FILE *fp, uint64_t *distinct, uint64_t *n_subtrees)
+{
+  kmer_node_t *frontier = NULL, *next = NULL;
+  uint64_t n_frontier = 0, frontier_size = 0, n_next = 0, next_size = 0;
+  uint64_t lf = 0;
+  char root[KSTEPS];
+
+  // roots: odd k-mers grow from single characters, even k-mers from pairs
+  for (uint len = 1; (len <= KSTEPS) && (len <= kmer_len); len++)
+  {
+    for (uint c = 0; c < (len == 1? SYMBOLS : K2_SYMBOLS); c++)
+    {
+      kmer_node_t node = { 0, 0, len, NULL };
+      root[0] = fmi.alphabet[(len == 1)? c : c >> BITS_PER_SYMBOL];
+      root[1] = fmi.alphabet[c & (SYMBOLS - 1)];
+      count_SFM(&fmi, root, len, &node.start, &node.end);
+      node.end++;
+      if (node.end - node.start < min_count) continue;
+      node.kmer = strndup(root, len);
+      push_node(&frontier, &n_frontier, &frontier_size, node);
+    }
+  }
+
+  // top of the tree: level by level, until there are enough subtrees
+  while (n_frontier < SUBTREES_PER_THREAD*nthreads)
+  {
+    uint expanded = 0;
+    n_next = 0;
+    for (uint64_t i = 0; i < n_frontier; i++)
+    {
+      kmer_node_t node = frontier[i];
+      uint64_t starts[K2_SYMBOLS], ends[K2_SYMBOLS];
+
+      if (node.len + KSTEPS > kmer_len)
+      {
+        push_node(&next, &n_next, &next_size, node);
+        continue;
+      }
+      fprintf(fp, "%.*s\t%lu\n", node.len, node.kmer, node.end - node.start);
+      distinct[node.len]++;
+      extend_SFM(&fmi, node.start, node.end, starts, ends);
+      lf += 2*K2_SYMBOLS;
+      expanded++;
+
+      for (uint c = 0; c < K2_SYMBOLS; c++)
+      {
+        if (ends[c] - starts[c] < min_count) continue;
+        kmer_node_t child = { starts[c], ends[c], node.len + KSTEPS,
+                              extend_kmer(node.kmer, node.len, c) };
+        push_node(&next, &n_next, &next_size, child);
+      }
+      free(node.kmer);
+    }
+
+    kmer_node_t *tmp = frontier;
+    frontier = next;
+    next = tmp;
+    n_frontier = n_next;
+    uint64_t tmp_size = frontier_size;
+    frontier_size = next_size;
+    next_size = tmp_size;
+    if (expanded == 0) break;
+  }
+  *n_subtrees = n_frontier;
+
+  // subtrees: in parallel, by waves to keep the output in order and bounded
+  uint64_t wave = SUBTREES_PER_THREAD*nthreads;
+  char **buffers = calloc(wave, sizeof(char*));
+  size_t *buffers_len = calloc(wave, sizeof(size_t));
+  if ((buffers == NULL) || (buffers_len == NULL))
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+
+  omp_set_num_threads(nthreads);
+  for (uint64_t w = 0; w < n_frontier; w += wave)
+  {
+    uint64_t w_end = (w + wave < n_frontier)? w + wave : n_frontier;
+
+    #pragma omp parallel reduction(+:lf)
+    {
+      uint64_t *th_distinct = calloc(kmer_len + 1, sizeof(uint64_t));
+      char *buffer = malloc(kmer_len);
+      if ((th_distinct == NULL) || (buffer == NULL))
+      {
+        printf("Error at malloc\n");
+        exit(EXIT_FAILURE);
+      }
+
+      #pragma omp for schedule(dynamic, 1) nowait
+      for (uint64_t i = w; i < w_end; i++)
+      {
+        kmer_node_t node = frontier[i];
+        char *kmer = buffer + kmer_len - node.len;
+        FILE *out = open_memstream(&buffers[i - w], &buffers_len[i - w]);
+        if (out == NULL)
+        {
+          printf("Error at malloc\n");
+          exit(EXIT_FAILURE);
+        }
+        memcpy(kmer, node.kmer, node.len);
+        traverse(node.start, node.end, kmer, node.len, out, th_distinct, &lf);
+        fclose(out);
+        free(node.kmer);
+      }
+
+      #pragma omp critical
+      for (uint l = 0; l <= kmer_len; l++)
+        distinct[l] += th_distinct[l];
+      free(th_distinct);
+      free(buffer);
+    }
+
+    for (uint64_t i = w; i < w_end; i++)
+    {
+      fwrite(buffers[i - w], sizeof(char), buffers_len[i - w], fp);
+      free(buffers[i - w]);
+    }
+  }
+
+  free(buffers);
+  free(buffers_len);
+  free(frontier);
+  free(next);
+  return lf;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+// Main function
+////////////////////////////////////////////////////////////////////////////////
+
+int
+main(int argc, char *argv[])
+{
+  char *fmi_file = 0;
+  char *out_file = 0;
+  uint64_t *distinct, lf, n_subtrees, total = 0;
+  double start_timer, end_timer;
+  int n = 0, option = 0;
+  FILE *fp;
+
+  while(1)
+  {
+      option = getopt_long(argc, argv, optString, longOpts, NULL /* &longIndex */);
+      if (option == -1) break;
+
+      switch(option)
+      {
+          case 'f':
+              fmi_file = optarg;
+              break;
+
+          case 'k':
+              n = sscanf(optarg, "%u", &kmer_len);
+              if ((n != 1) || (kmer_len < 1) || (kmer_len > MAX_KMER_LEN))
+              {
+                  printf("ERROR: wrong k-mer length (1-%d)\n\n", MAX_KMER_LEN);
+                  exit(1);
+              }
+              break;
+
+          case 'c':
+              n = sscanf(optarg, "%lu", &min_count);
+              if ((n != 1) || (min_count < 1))
+              {
+                  printf("ERROR: wrong minimum count\n\n");
+                  exit(1);
+              }
+              break;
+
+          case 't':
+              n = sscanf(optarg, "%u", &nthreads);
+              if ((n != 1) || (nthreads < 1))
+              {
+                  printf("ERROR: wrong number of threads\n\n");
+                  exit(1);
+              }
+              break;
+
+          case 'o':
+              out_file = optarg;
+              break;
+
+          case 'h':
+              show_usage(argv[0], 0);
+              break;
+
+          default:
+              show_usage(argv[0], 1);
+      }
+  }
+
+  /* check arguments */
+  if (fmi_file == 0)
+  {
+      printf("ERROR: fm-index file not specified\n");
+      show_usage(argv[0], 1);
+  }
+  if (kmer_len == 0)
+  {
+      printf("ERROR: k-mer length not specified\n");
+      show_usage(argv[0], 1);
+  }
+  if (out_file == 0)
+  {
+      printf("ERROR: output file not specified\n");
+      show_usage(argv[0], 1);
+  }
+
+  printf("Loading FM-index...\n");
+  start_timer = omp_get_wtime();
+  if (load_SFM(fmi_file, &fmi) < 0) exit(EXIT_FAILURE);
+  end_timer = omp_get_wtime();
+  printf("OK. Index loaded in %fs\n", end_timer - start_timer);
+  printf(HLINE);
+
+  printf("Parameters\n");
+  printf("- FM-index file: %s\n", fmi_file);
+  printf("- Index size: %.1fGiB (%lu characters)\n", (double)(fmi.len)/GiB, fmi.len);
+  printf("- Maximum k-mer length: %u\n", kmer_len);
+  printf("- Minimum number of occurrences: %lu\n", min_count);
+  printf("- Number of threads: %d\n", nthreads);
+  printf(HLINE);
+
+  fp = fopen(out_file, "w");
+  if (fp == NULL)
+  {
+    printf("Error opening file %s\n", out_file);
+    exit(EXIT_FAILURE);
+  }
+  distinct = calloc(kmer_len + 1, sizeof(uint64_t));
+  if (distinct == NULL)
+  {
+    printf("Error at malloc\n");
+    exit(EXIT_FAILURE);
+  }
+
+  printf("Traversing FM-index... \n");
+  start_timer = omp_get_wtime();
+  lf = spectrum(fp, distinct, &n_subtrees);
+  end_timer = omp_get_wtime();
+  fclose(fp);
+  printf("OK\n");
+
+  for (uint l = 1; l <= kmer_len; l++)
+  {
+    printf("- %u-mers: %lu\n", l, distinct[l]);
+    total += distinct[l];
+  }
+  printf("Distinct k-mers: %lu (%lu subtrees)\n", total, n_subtrees);
+  printf("Total LFOP: %.2fG\n", lf/GIGA);
+  printf("Total time: %f\n", end_timer - start_timer);
+  printf("Raw throughput: %6.3f GLFOPS\n", lf/(end_timer - start_timer)/GIGA);
+  printf("k-mers written to file %s\n", out_file);
+  printf(HLINE);
+
+  free(distinct);
+  free_SFM(&fmi);
+  return 0;
+}
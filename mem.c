@@ -47,9 +47,12 @@
 #if LIBNUMA
 #include <numa.h>
 #include <numaif.h>
+#endif
 
 #include "mem.h"
 
+#if LIBNUMA
+
 
 static void
 print_oneline_file(char *filename)
@@ -138,3 +141,200 @@ mem_conf()
   return node;
 }
 #endif
+
+
+/* parses a cpulist (for instance, 0-13,28-41) */
+static int
+cpulist_to_cpuset(const char *list, cpu_set_t *set)
+{
+  int ncpus = 0;
+  const char *p = list;
+
+  CPU_ZERO(set);
+  while (*p != 0 && *p != '\n')
+  {
+    char *q;
+    long first = strtol(p, &q, 10), last;
+    if (q == p) return -1;
+    last = first;
+    if (*q == '-')
+    {
+      p = q + 1;
+      last = strtol(p, &q, 10);
+      if (q == p) return -1;
+    }
+    for (long cpu = first; cpu <= last; cpu++)
+    {
+      CPU_SET(cpu, set);
+      ncpus++;
+    }
+    p = (*q == ',')? q + 1 : q;
+  }
+  return ncpus;
+}
+
+
+int
+num_nodes()
+{
+  char filename[128];
+  int nodes = 0;
+
+  do
+  {
+    snprintf(filename, sizeof(filename), "/sys/devices/system/node/node%d", nodes);
+    if (access(filename, F_OK) != 0) break;
+    nodes++;
+  } while (1);
+
+  return nodes > 0? nodes : 1;
+}
+
+
+int
+bind_to_node(int node)
+{
+  char filename[128];
+  size_t len = 0;
+  char *linep = NULL;
+  cpu_set_t set;
+  FILE * fp;
+  int ncpus;
+
+  snprintf(filename, sizeof(filename), "/sys/devices/system/node/node%d/cpulist", node);
+  fp = fopen(filename, "r");
+  if (fp == NULL) return -1;
+  if (getline(&linep, &len, fp) == -1)
+  {
+    fclose(fp);
+    return -1;
+  }
+  fclose(fp);
+
+  ncpus = cpulist_to_cpuset(linep, &set);
+  free(linep);
+  if (ncpus <= 0) return -1;
+  if (sched_setaffinity(0, sizeof(set), &set) != 0) return -1;
+
+#if LIBNUMA
+  // allocate memory in the same node
+  if (numa_available() != -1)
+    numa_set_preferred(node);
+#endif
+  return ncpus;
+}
+
+
+/* reads an integer from a sysfs file, returns -1 if error */
+static int
+read_int_file(const char *filename)
+{
+  FILE * fp = fopen(filename, "r");
+  int value = -1;
+
+  if (fp == NULL) return -1;
+  if (fscanf(fp, "%d", &value) != 1) value = -1;
+  fclose(fp);
+  return value;
+}
+
+
+int
+read_topology(cpu_topo_t *cpus, int max)
+{
+  char filename[128];
+  cpu_set_t allowed;
+  int ncpus = 0;
+
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return -1;
+
+  for (int cpu = 0; (cpu < CPU_SETSIZE) && (ncpus < max); cpu++)
+  {
+    if (!CPU_ISSET(cpu, &allowed)) continue;
+    cpus[ncpus].cpu = cpu;
+    snprintf(filename, sizeof(filename), "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+    cpus[ncpus].socket = read_int_file(filename);
+    snprintf(filename, sizeof(filename), "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu);
+    cpus[ncpus].core = read_int_file(filename);
+    // without topology info, every cpu is a core of a single socket
+    if (cpus[ncpus].socket < 0) cpus[ncpus].socket = 0;
+    if (cpus[ncpus].core < 0) cpus[ncpus].core = cpu;
+    ncpus++;
+  }
+
+  // core_id is not contiguous: rank of the core in its socket, and
+  // rank of the hardware thread in its core (cpus in increasing order)
+  for (int i = 0; i < ncpus; i++)
+  {
+    int core = 0, smt = 0;
+    for (int j = 0; j < i; j++)
+    {
+      if (cpus[j].socket != cpus[i].socket) continue;
+      if (cpus[j].core == cpus[i].core) smt++;
+    }
+    for (int j = 0; j < ncpus; j++)
+    {
+      int first = 1;
+      if ((cpus[j].socket != cpus[i].socket) || (cpus[j].core >= cpus[i].core)) continue;
+      // count each core once
+      for (int k = 0; k < j; k++)
+        if ((cpus[k].socket == cpus[j].socket) && (cpus[k].core == cpus[j].core)) first = 0;
+      core += first;
+    }
+    cpus[i].smt = smt;
+    cpus[i].core_rank = core;
+  }
+  return ncpus;
+}
+
+
+/* sort key of a cpu for a placement policy (most significant first) */
+static void
+topology_key(const cpu_topo_t *c, int policy, int key[3])
+{
+  switch (policy)
+  {
+    case BIND_SCATTER:
+      key[0] = c->smt; key[1] = c->core_rank; key[2] = c->socket;
+      break;
+    case BIND_SOCKET:
+      key[0] = c->socket; key[1] = c->smt; key[2] = c->core_rank;
+      break;
+    case BIND_SMT:
+      key[0] = c->core_rank; key[1] = c->socket; key[2] = c->smt;
+      break;
+    default: // BIND_COMPACT
+      key[0] = c->socket; key[1] = c->core_rank; key[2] = c->smt;
+  }
+}
+
+
+static int
+compare_topology(const void *a, const void *b, void *policy)
+{
+  int key_a[3], key_b[3];
+
+  topology_key(a, *(int*) policy, key_a);
+  topology_key(b, *(int*) policy, key_b);
+  for (int i = 0; i < 3; i++)
+    if (key_a[i] != key_b[i]) return key_a[i] - key_b[i];
+  return ((const cpu_topo_t*) a)->cpu - ((const cpu_topo_t*) b)->cpu;
+}
+
+
+void
+sort_topology(cpu_topo_t *cpus, int ncpus, int policy)
+{
+  qsort_r(cpus, ncpus, sizeof(cpu_topo_t), compare_topology, &policy);
+}
+
+
+int
+bind_to_cpu(int cpu)
+{
+  cpu_set_t set;
+
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return sched_setaffinity(0, sizeof(set), &set);
+}
@@ -64,4 +64,36 @@ void hugepages_status();
 
 int mem_conf();
 
+/* number of NUMA nodes (1 if NUMA info is not available) */
+int num_nodes();
+
+/* binds the calling process to the cpus (and memory) of a NUMA node
+   returns the number of cpus of the node, negative if error */
+int bind_to_node(int node);
+
+/* hardware thread (logical cpu) and its place in the topology */
+typedef struct cpu_topo {
+  int cpu;
+  int socket;       /* physical package */
+  int core;         /* core_id (not contiguous) */
+  int core_rank;    /* core in its socket: 0, 1, ... */
+  int smt;          /* hardware thread in its core: 0, 1, ... */
+} cpu_topo_t;
+
+/* placement policies of sort_topology() */
+#define BIND_COMPACT 0   /* socket by socket, core by core, SMT siblings together */
+#define BIND_SCATTER 1   /* a core of each socket in turn, SMT siblings last */
+#define BIND_SOCKET  2   /* socket by socket, the cores first, SMT siblings last */
+#define BIND_SMT     3   /* SMT siblings together, a core of each socket in turn */
+
+/* reads from sysfs the topology of the cpus the calling thread may run on
+   returns the number of cpus (at most max), negative if error */
+int read_topology(cpu_topo_t *cpus, int max);
+
+/* orders the cpus for a placement policy: thread t runs on cpus[t % ncpus] */
+void sort_topology(cpu_topo_t *cpus, int ncpus, int policy);
+
+/* binds the calling thread to a cpu, returns 0 or negative if error */
+int bind_to_cpu(int cpu);
+
 #endif
@@ -0,0 +1,101 @@
+#!/bin/bash
+
+# checks that the sequence file is split and parsed the same way whatever the
+# number of parser threads (-t) and processes (-p): the reads of a FASTQ file
+# with wrapped records, sampled from the reference (one in three with a
+# mutated base), are counted and searched with -t 1, -t nthreads and -p 3,
+# and the per-read occurrences must match
+#
+# use:
+#    ./check_parse.sh [-a architecture] [-c compiler] [-t nthreads]
+
+# default values
+version="k2d64bv"
+arch=gen
+comp=gcc
+nthreads=4
+nseqs=4
+pfetch=dp
+
+gref=lambda_virus
+nreads=40000
+
+while getopts "a:v:c:t:h" opt; do
+  case $opt in
+    a)
+      arch=$OPTARG
+      ;;
+    v)
+      version=$OPTARG
+      ;;
+    c)
+      comp=$OPTARG
+      ;;
+    t)
+      nthreads=$OPTARG
+      ;;
+    h)
+      echo "use:"
+      echo "$0 -v version  -c compiler -a architecture -t nthreads"
+      echo "example:"
+      echo "$0 -v k2d64bv -c gcc -a gen -t 4"
+      exit
+      ;;
+    \?)
+      echo "invalid option: -$OPTARG"
+      exit 1
+      ;;
+    :)
+      echo "-$OPTARG option requires a parameter"
+      exit 1
+      ;;
+  esac
+done
+
+PREFIX=../bin
+bin=${PREFIX}/${version}_fcount.${arch}.${comp}.${nseqs}seq.${pfetch}
+reffile=../references/${gref}.${version}.fmi
+if [ ! -f ${reffile} ]; then
+    ${PREFIX}/${version}_build.${arch}.${comp} ../references/${gref} > /dev/null || exit 1
+fi
+
+tmpdir=`mktemp -d`
+trap "rm -rf ${tmpdir}" EXIT
+
+# reads of 100 bases, sequence and quality wrapped in 2 lines of 50
+# (quality values starting with '@' and '+' included)
+seqfile=${tmpdir}/wrapped.fq
+awk -v n=${nreads} '{ g = g $0 } END {
+    srand(1); split("A C G T", b, " "); split("@ I H # 5 +", q, " ");
+    for (r = 0; r < n; r++) {
+        s = substr(g, int(rand()*(length(g) - 99)) + 1, 100); v = "";
+        if (r % 3 == 2) {
+            i = int(rand()*100) + 1; c = substr(s, i, 1);
+            do m = b[int(rand()*4) + 1]; while (m == c);
+            s = substr(s, 1, i - 1) m substr(s, i + 1);
+        }
+        for (i = 0; i < 100; i++) v = v q[int(rand()*6) + 1];
+        printf "@r%d\n%s\n%s\n+\n%s\n%s\n", r, substr(s, 1, 50), substr(s, 51), substr(v, 1, 50), substr(v, 51);
+    } }' ../references/${gref} > ${seqfile}
+
+status=0
+for run in "-t 1" "-t ${nthreads}" "-t ${nthreads} -p 3"; do
+    out=${tmpdir}/out.`echo ${run} | tr -d ' -'`.txt
+    ${bin} -f ${reffile} -s ${seqfile} ${run} -r 2 -o ${out} > /dev/null 2>&1 || { echo "${run}: FAILED"; status=1; continue; }
+    count=`wc -l < ${out}`
+    occs=`awk '{ s += $NF } END { print s + 0 }' ${out}`
+    echo "${run}: ${count} reads, ${occs} occurrences"
+    if [ ${count} -ne ${nreads} ] || [ ${occs} -eq 0 ]; then
+        status=1
+    elif [ "${run}" != "-t 1" ] && ! cmp -s ${out} ${tmpdir}/out.t1.txt; then
+        echo "${run}: per-read occurrences differ from -t 1"
+        status=1
+    fi
+done
+
+if [ ${status} -eq 0 ]; then
+    printf "OK\n"
+else
+    printf "FAILED\n"
+fi
+exit ${status}
@@ -12,16 +12,8 @@ arch_list=("gen")
 comp_list=("gcc")
 # comp_list=("icc" "gcc-6" "gcc-7" )
 
-# number of overlapped searches
-# skl
-nseq_list=("16")
-# nseq_list=("16" "24" "32" "40")
-# knl
-# nseq_list=("2" "4" "6" "8")
-
-# types of software prefetch
-pfetch_list=("sp")
-# pfetch_list=("sp" "dp")
+# the binary contains every kernel (number of overlapped searches and type
+# of software prefetch), selected at runtime with -n (see run_all.sh)
 
 # collect hw counters with perf
 perf=0
@@ -35,17 +27,9 @@ do
         # loop over the compilers
         for comp in "${comp_list[@]}"
         do
-            # loop over the overlapped searches
-            for nseq in "${nseq_list[@]}"
-            do
-                # loop over the prefetches
-                for pfetch in "${pfetch_list[@]}"
-                do
-                    # -b: compile FMindex build program
-                    # -d: compile FMindex count program
-                    ./compile.sh -v $version -a $arch -c $comp -s $nseq -p $pfetch -w $perf
-                done
-            done
+            # -b: compile FMindex build program
+            # -d: compile FMindex count program
+            ./compile.sh -v $version -a $arch -c $comp -w $perf
         done
     done
 done
@@ -89,12 +89,14 @@ cat /proc/cpuinfo | grep 'model name' | uniq | cut -f2 --delimiter=: >> ${outfil
 echo -n "Date: " >> ${outfile} 
 LANG=en_EN date >> ${outfile}
 
+# binary compiled by compile.sh with its default kernel (4 sequences, sp);
+# the kernel given by -s and -p is selected at runtime (-n)
 PREFIX=../bin
-bin=${PREFIX}/${version}_fcount.${arch}.${comp}.${nseqs}seq.${pfetch}
+bin=${PREFIX}/${version}_fcount.${arch}.${comp}.4seq.sp
 reffile=../references/${gref}.${version}.fmi
 seqfile=../sequences/${file_seq}
-echo -n "executing ${bin} -f ${reffile}  -s ${seqfile} -t ${nthreads} ... "
-${bin} -f ${reffile} -s ${seqfile} -t ${nthreads} >> ${outfile} 2>&1
+echo -n "executing ${bin} -f ${reffile}  -s ${seqfile} -t ${nthreads} -n ${nseqs}${pfetch} ... "
+${bin} -f ${reffile} -s ${seqfile} -t ${nthreads} -n ${nseqs}${pfetch} >> ${outfile} 2>&1
 # If the aligner is executed in a multiprocessor system,
 # best results are obtained if all the threads are executed in the same processor
 # For instance, for a 2xIntel Xeon Gold 5120 system:
@@ -109,5 +111,7 @@ ${bin} -f ${reffile} -s ${seqfile} -t ${nthreads} >> ${outfile} 2>&1
 # KMP_AFFINITY=verbose,granularity=thread,compact ${bin} ../References/${gref}.${version}.fmi ../Sequences/${file_seq} >> ${outfile} 2>&1
 # KMP_AFFINITY=verbose,granularity=core,compact ${bin} ../References/${gref}.${version}.fmi ../Sequences/${file_seq} >> ${outfile} 2>&1
 # taskset -c 14-27,42-55 ${bin} ../References/${gref}.${version}.fmi ../Sequences/${file_seq} >> ${outfile} 2>&1
+# or let the aligner pin the threads (compact, scatter, socket or smt, see MANUAL.md):
+# ${bin} -f ${reffile} -s ${seqfile} -t ${nthreads} -B socket >> ${outfile} 2>&1
 echo >> ${outfile}
 printf "OK\n\n"
@@ -45,14 +45,15 @@ do
         # loop over the compilers
         for comp in "${comp_list[@]}"
         do
+            # a single binary: the kernel is selected at runtime (-n)
+            # -b: ejecucion de build, -d: ejecucion de count
+            ./compile.sh -v $version -a $arch -c $comp -w $perf
             # loop over the overlapped searches
             for nseq in "${nseq_list[@]}"
             do
                 # loop over the prefetches
                 for pfetch in "${pfetch_list[@]}"
                 do
-                    # -b: ejecucion de build, -d: ejecucion de count
-                    ./compile.sh -v $version -a $arch -c $comp -s $nseq -p $pfetch -w $perf
                     # loop over the threads
                     for nthreads in "${nthreads_list[@]}"
                     do